@@ -0,0 +1,533 @@
+#include <QBuffer>
+#include <QFile>
+#include <QImage>
+#include <QSet>
+#include <QVector>
+
+#include <cstring>
+#include <random>
+
+#include "dictgenerator.h"
+
+namespace {
+
+const quint32 kNotSet         = 0xFFFFFFFF;
+const int kTextRecordSize     = 4096;
+const int kIndxHeaderLength   = 192;
+const int kIndxRecordMaxSize  = 60000;
+const int kIndxRecordMaxCount = 1000;
+const int kMobiHeaderLength   = 232;
+const int kFilePosWidth       = 10;
+
+// PalmDOC back references reach 2047 bytes back and copy 3 to 10 bytes
+const int kMaxDistance = 2047;
+const int kMinLength   = 3;
+const int kMaxLength   = 10;
+const int kHashSize    = 4096;
+const int kMaxChain    = 64;
+
+void put8(QByteArray *out, quint8 v)
+{
+  out->append(char(v));
+}
+
+void put16(QByteArray *out, quint16 v)
+{
+  out->append(char(v >> 8));
+  out->append(char(v & 0xff));
+}
+
+void put32(QByteArray *out, quint32 v)
+{
+  put16(out, v >> 16);
+  put16(out, v & 0xffff);
+}
+
+void set32(QByteArray *out, int pos, quint32 v)
+{
+  (*out)[pos]     = char(v >> 24);
+  (*out)[pos + 1] = char((v >> 16) & 0xff);
+  (*out)[pos + 2] = char((v >> 8) & 0xff);
+  (*out)[pos + 3] = char(v & 0xff);
+}
+
+// Forward encoded, 7 bits per byte, the last byte is flagged with 0x80
+void putVarlen(QByteArray *out, quint32 v)
+{
+  char bytes[5];
+  int count = 0;
+
+  do {
+    bytes[count++] = v & 0x7f;
+    v >>= 7;
+  } while (v != 0);
+
+  while (count--)
+    out->append(char(bytes[count] | (count == 0 ? 0x80 : 0)));
+}
+
+void padTo(QByteArray *out, int size)
+{
+  if (out->size() < size)
+    out->append(QByteArray(size - out->size(), '\0'));
+}
+
+// Bytes the decoder would take for a command rather than a literal
+bool needsEscape(uchar c)
+{
+  return (c >= 0x01 && c <= 0x08) || c >= 0x80;
+}
+
+// LZ77 as decoded by the PalmDOC readers, with back references found
+// through hash chains on 3 byte prefixes
+QByteArray palmDocCompress(const QByteArray &in)
+{
+  const uchar *data = reinterpret_cast<const uchar *>(in.constData());
+  const int size    = in.size();
+
+  const auto hashAt = [data](int pos) {
+    return ((data[pos] << 8) ^ (data[pos + 1] << 4) ^ data[pos + 2]) &
+           (kHashSize - 1);
+  };
+
+  QVector<int> head(kHashSize, -1);
+  QVector<int> previous(size, -1);
+  QByteArray out;
+  int i = 0;
+
+  while (i < size) {
+    int bestLength   = 0;
+    int bestDistance = 0;
+
+    if (i + kMinLength <= size) {
+      int candidate = head[hashAt(i)];
+
+      for (int chain = 0; candidate >= 0 && chain < kMaxChain &&
+                          i - candidate <= kMaxDistance;
+           ++chain, candidate = previous[candidate]) {
+        // Copies do not overlap what they are writing
+        const int distance = i - candidate;
+        const int limit    = qMin(qMin(kMaxLength, size - i), distance);
+
+        int length = 0;
+        while (length < limit && data[candidate + length] == data[i + length])
+          ++length;
+
+        if (length > bestLength) {
+          bestLength   = length;
+          bestDistance = distance;
+        }
+      }
+    }
+
+    int advance = 1;
+
+    if (bestLength >= kMinLength) {
+      put16(&out, 0x8000 | (bestDistance << 3) | (bestLength - kMinLength));
+      advance = bestLength;
+    }
+    else if (data[i] == ' ' && i + 1 < size && data[i + 1] >= 0x40 &&
+             data[i + 1] <= 0x7f) {
+      put8(&out, data[i + 1] ^ 0x80);
+      advance = 2;
+    }
+    else if (!needsEscape(data[i])) {
+      put8(&out, data[i]);
+    }
+    else {
+      // Up to 8 bytes copied as they are
+      while (advance < 8 && i + advance < size &&
+             needsEscape(data[i + advance]))
+        ++advance;
+
+      put8(&out, advance);
+      out.append(in.constData() + i, advance);
+    }
+
+    for (const int end = i + advance; i < end; ++i) {
+      if (i + kMinLength <= size) {
+        const int hash = hashAt(i);
+        previous[i]    = head[hash];
+        head[hash]     = i;
+      }
+    }
+  }
+
+  return out;
+}
+
+QByteArray orthHeaderRecord(int dataRecords, int totalEntries)
+{
+  QByteArray r;
+  r.append("INDX");
+  put32(&r, kIndxHeaderLength);
+  put32(&r, 0);
+  put32(&r, 0);  // type: normal
+  put32(&r, 0);
+  put32(&r, 0);  // IDXT offset, unused in the header record
+  put32(&r, dataRecords);
+  put32(&r, 65001);  // UTF-8
+  put32(&r, kNotSet);
+  put32(&r, totalEntries);
+  padTo(&r, kIndxHeaderLength);
+
+  // Tags: 1 - entry start position, 2 - entry length
+  r.append("TAGX");
+  put32(&r, 12 + 3 * 4);
+  put32(&r, 1);  // control bytes
+  r.append("\x01\x01\x01\x00", 4);
+  r.append("\x02\x01\x02\x00", 4);
+  r.append("\x00\x00\x00\x01", 4);
+
+  return r;
+}
+
+QByteArray orthDataRecord(const QList<QByteArray> &entries)
+{
+  QByteArray r;
+  r.append("INDX");
+  put32(&r, kIndxHeaderLength);
+  put32(&r, 0);
+  put32(&r, 0);
+  put32(&r, 1);
+  put32(&r, 0);  // IDXT offset, patched below
+  put32(&r, entries.size());
+  padTo(&r, kIndxHeaderLength);
+
+  QList<int> offsets;
+  for (const auto &entry : entries) {
+    offsets.append(r.size());
+    r.append(entry);
+  }
+
+  set32(&r, 20, r.size());
+  r.append("IDXT");
+  for (int offset : offsets)
+    put16(&r, offset);
+
+  padTo(&r, (r.size() + 3) & ~3);
+  return r;
+}
+
+QByteArray pngRecord(int index, std::mt19937 *rng)
+{
+  const int size = 16 + (*rng)() % 48;
+  QImage image(size, size, QImage::Format_RGB32);
+  image.fill(QColor::fromHsv(index * 37 % 360, 160, 220));
+
+  for (int y = 0; y < size; y += 4)
+    for (int x = (y / 4) % 2 * 4; x < size; x += 8)
+      image.setPixel(x, y, qRgb((*rng)() % 256, (*rng)() % 256, 0));
+
+  QByteArray data;
+  QBuffer buffer(&data);
+  buffer.open(QIODevice::WriteOnly);
+  image.save(&buffer, "PNG");
+
+  return data;
+}
+
+}  // namespace
+
+DictGenerator::DictGenerator()
+{
+  m_headwords      = 10000;
+  m_entriesPerWord = 1.2;
+  m_linkDensity    = 0.5;
+  m_imageCount     = 100;
+  m_seed           = 1;
+  m_compressed     = false;
+}
+
+void DictGenerator::setHeadwords(int headwords)
+{
+  m_headwords = headwords;
+}
+
+void DictGenerator::setEntriesPerWord(double entriesPerWord)
+{
+  m_entriesPerWord = qMax(1.0, entriesPerWord);
+}
+
+void DictGenerator::setLinkDensity(double linkDensity)
+{
+  m_linkDensity = qMax(0.0, linkDensity);
+}
+
+void DictGenerator::setImageCount(int imageCount)
+{
+  m_imageCount = imageCount;
+}
+
+void DictGenerator::setSeed(quint32 seed)
+{
+  m_seed = seed;
+}
+
+void DictGenerator::setCompressed(bool compressed)
+{
+  m_compressed = compressed;
+}
+
+const QStringList &DictGenerator::words() const
+{
+  return m_words;
+}
+
+const QList<quint32> &DictGenerator::entryOffsets() const
+{
+  return m_entryOffsets;
+}
+
+void DictGenerator::pickWords(std::mt19937 *rng)
+{
+  static const char *syllables[] = {"ka", "lo", "mi",  "ne", "ru", "ta", "shi",
+                                    "po", "va", "de",  "an", "el", "or", "um",
+                                    "st", "qu", "gri", "ba", "ze", "fy"};
+  const int syllableCount = sizeof(syllables) / sizeof(syllables[0]);
+
+  m_words.clear();
+
+  QSet<QString> seen;
+  while (m_words.size() < m_headwords) {
+    QString word;
+    const int length = 1 + (*rng)() % 4;
+    for (int i = 0; i < length; ++i)
+      word += syllables[(*rng)() % syllableCount];
+
+    if ((*rng)() % 10 == 0)
+      word[0] = word[0].toUpper();
+
+    if (seen.contains(word))
+      word += QString::number(m_words.size());
+
+    if (seen.contains(word))
+      continue;
+
+    seen.insert(word);
+    m_words.append(word);
+  }
+}
+
+void DictGenerator::generateWords()
+{
+  std::mt19937 rng(m_seed);
+  pickWords(&rng);
+}
+
+bool DictGenerator::write(const QString &path)
+{
+  std::mt19937 rng(m_seed);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  m_entryOffsets.clear();
+  pickWords(&rng);
+
+  // Entries in text order, each remembering its headword
+  QList<int> entryWords;
+  for (int i = 0; i < m_words.size(); ++i) {
+    int count = int(m_entriesPerWord);
+    if (uniform(rng) < m_entriesPerWord - count)
+      ++count;
+
+    for (int j = 0; j < count; ++j)
+      entryWords.append(i);
+  }
+
+  QByteArray text = "<html><head><guide></guide></head><body>";
+  QList<QPair<int, int>> links;  // text position, target entry
+
+  for (int i = 0; i < entryWords.size(); ++i) {
+    const QByteArray word = m_words[entryWords[i]].toUtf8();
+    m_entryOffsets.append(text.size());
+
+    text += "<idx:entry><b>" + word + "</b> <i>n.</i> ";
+
+    const int fillers = 10 + rng() % 30;
+    for (int j = 0; j < fillers; ++j)
+      text += m_words[rng() % m_words.size()].toUtf8() + ' ';
+
+    int linkCount = int(m_linkDensity);
+    if (uniform(rng) < m_linkDensity - linkCount)
+      ++linkCount;
+
+    for (int j = 0; j < linkCount; ++j) {
+      const int target = rng() % entryWords.size();
+      text += "See <a filepos=";
+      links.append(qMakePair(text.size(), target));
+      text += QByteArray(kFilePosWidth, '0') + '>' +
+              m_words[entryWords[target]].toUtf8() + "</a>. ";
+    }
+
+    if (m_imageCount > 0 && uniform(rng) < 0.1)
+      text += QString("<img recindex=\"%1\"/>")
+                  .arg(rng() % m_imageCount, 5, 10, QChar('0'))
+                  .toUtf8();
+
+    text += "</idx:entry><hr/>";
+  }
+
+  text += "</body></html>";
+
+  for (const auto &link : links) {
+    const QByteArray pos = QByteArray::number(m_entryOffsets[link.second])
+                               .rightJustified(kFilePosWidth, '0');
+    text.replace(link.first, kFilePosWidth, pos);
+  }
+
+  // Entry lengths follow from the next entry's offset minus the separator
+  QList<QByteArray> orthEntries;
+  for (int i = 0; i < entryWords.size(); ++i) {
+    const quint32 end = i + 1 < entryWords.size()
+                            ? m_entryOffsets[i + 1]
+                            : quint32(text.size() - strlen("</body></html>"));
+    const QByteArray label = m_words[entryWords[i]].toUtf8();
+
+    QByteArray entry;
+    put8(&entry, label.size());
+    entry.append(label);
+    put8(&entry, 0x03);
+    putVarlen(&entry, m_entryOffsets[i]);
+    putVarlen(&entry, end - m_entryOffsets[i] - strlen("<hr/>"));
+    orthEntries.append(entry);
+  }
+
+  QList<QByteArray> records;
+  records.append(QByteArray());  // record 0, written last
+
+  for (int pos = 0; pos < text.size(); pos += kTextRecordSize) {
+    const QByteArray record = text.mid(pos, kTextRecordSize);
+    records.append(m_compressed ? palmDocCompress(record) : record);
+  }
+
+  const int textRecordCount = records.size() - 1;
+  const int orthIndex       = records.size();
+
+  QList<QList<QByteArray>> chunks;
+  QList<QByteArray> chunk;
+  int chunkSize = kIndxHeaderLength;
+
+  for (const auto &entry : orthEntries) {
+    if (chunk.size() == kIndxRecordMaxCount ||
+        chunkSize + entry.size() + 2 > kIndxRecordMaxSize) {
+      chunks.append(chunk);
+      chunk.clear();
+      chunkSize = kIndxHeaderLength;
+    }
+
+    chunk.append(entry);
+    chunkSize += entry.size() + 2;
+  }
+
+  if (!chunk.isEmpty())
+    chunks.append(chunk);
+
+  records.append(orthHeaderRecord(chunks.size(), orthEntries.size()));
+  for (const auto &c : chunks)
+    records.append(orthDataRecord(c));
+
+  const int firstImage = records.size();
+  for (int i = 0; i < m_imageCount; ++i)
+    records.append(pngRecord(i, &rng));
+
+  // EOF marker ends resource scanning
+  records.append(QByteArray("\xe9\x8e\r\n", 4));
+
+  const QByteArray title =
+      QString("Synthetic %1 words").arg(m_headwords).toUtf8();
+
+  QByteArray &r0 = records[0];
+  put16(&r0, m_compressed ? 2 : 1);  // PalmDOC or no compression
+  put16(&r0, 0);
+  put32(&r0, text.size());
+  put16(&r0, textRecordCount);
+  put16(&r0, kTextRecordSize);
+  put16(&r0, 0);  // no encryption
+  put16(&r0, 0);
+
+  r0.append("MOBI");
+  put32(&r0, kMobiHeaderLength);
+  put32(&r0, 2);      // book
+  put32(&r0, 65001);  // UTF-8
+  put32(&r0, m_seed);
+  put32(&r0, 6);  // file version
+  put32(&r0, orthIndex);
+  for (int i = 0; i < 9; ++i)
+    put32(&r0, kNotSet);  // infl, names, keys, extra 0-5
+  put32(&r0, orthIndex);  // first non text record
+  put32(&r0, 16 + kMobiHeaderLength);
+  put32(&r0, title.size());
+  put32(&r0, 9);  // English
+  put32(&r0, 0);
+  put32(&r0, 0);
+  put32(&r0, 6);  // min version
+  put32(&r0, m_imageCount > 0 ? quint32(firstImage) : kNotSet);
+  put32(&r0, 0);  // huffman records
+  put32(&r0, 0);
+  put32(&r0, 0);  // DATP records
+  put32(&r0, 0);
+  put32(&r0, 0);  // no EXTH
+  r0.append(QByteArray(32, '\0'));
+  put32(&r0, kNotSet);
+  put32(&r0, kNotSet);  // DRM offset
+  put32(&r0, 0);
+  put32(&r0, 0);
+  put32(&r0, 0);
+  r0.append(QByteArray(8, '\0'));
+  put16(&r0, 1);  // first text record
+  put16(&r0, textRecordCount);
+  put32(&r0, 1);
+  put32(&r0, kNotSet);  // FCIS
+  put32(&r0, 0);
+  put32(&r0, kNotSet);  // FLIS
+  put32(&r0, 0);
+  put32(&r0, 0);
+  put32(&r0, 0);
+  put32(&r0, kNotSet);  // SRCS
+  put32(&r0, 0);
+  put32(&r0, kNotSet);
+  put32(&r0, kNotSet);
+  put16(&r0, 0);
+  put16(&r0, 0);  // no trailing entries
+  put32(&r0, kNotSet);  // NCX
+
+  Q_ASSERT(r0.size() == 16 + kMobiHeaderLength);
+  r0.append(title);
+  padTo(&r0, (r0.size() + 2 + 3) & ~3);
+
+  QByteArray pdb = title.left(31);
+  padTo(&pdb, 32);
+  put16(&pdb, 0);  // attributes
+  put16(&pdb, 0);  // version
+  put32(&pdb, 0x5A000000);  // creation, modification and backup times
+  put32(&pdb, 0x5A000000);
+  put32(&pdb, 0);
+  put32(&pdb, 0);  // modification number
+  put32(&pdb, 0);  // app info
+  put32(&pdb, 0);  // sort info
+  pdb.append("BOOKMOBI");
+  put32(&pdb, 2 * records.size() - 1);
+  put32(&pdb, 0);
+  put16(&pdb, records.size());
+
+  quint32 offset = pdb.size() + 8 * records.size() + 2;
+  for (int i = 0; i < records.size(); ++i) {
+    put32(&pdb, offset);
+    put8(&pdb, 0);
+    put8(&pdb, 0);
+    put16(&pdb, 2 * i);
+    offset += records[i].size();
+  }
+
+  put16(&pdb, 0);
+
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly))
+    return false;
+
+  file.write(pdb);
+  for (const auto &record : records)
+    file.write(record);
+
+  return file.error() == QFile::NoError;
+}
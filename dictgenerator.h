@@ -0,0 +1,47 @@
+#ifndef DICTGENERATOR_H
+#define DICTGENERATOR_H
+
+#include <QString>
+#include <QStringList>
+
+#include <random>
+
+// Writes deterministic MOBI dictionaries for benchmarking.
+//
+// The file holds the entry text records, uncompressed or PalmDOC compressed,
+// an ORTH index pointing into them, and PNG image records. Entries link to
+// each other with filepos anchors and reference images with recindex
+// attributes, like Kindle dictionaries do.
+class DictGenerator {
+ public:
+  DictGenerator();
+
+  void setHeadwords(int);
+  void setEntriesPerWord(double);
+  void setLinkDensity(double);
+  void setImageCount(int);
+  void setSeed(quint32);
+  void setCompressed(bool);
+
+  bool write(const QString& path);
+  // Only the headwords write() would use, without a file
+  void generateWords();
+
+  const QStringList& words() const;
+  const QList<quint32>& entryOffsets() const;
+
+ private:
+  void pickWords(std::mt19937*);
+
+  int m_headwords;
+  double m_entriesPerWord;
+  double m_linkDensity;
+  int m_imageCount;
+  quint32 m_seed;
+  bool m_compressed;
+
+  QStringList m_words;
+  QList<quint32> m_entryOffsets;
+};
+
+#endif
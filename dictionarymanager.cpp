@@ -0,0 +1,381 @@
+#include <QtConcurrent/qtconcurrentmap.h>
+#include <QtConcurrent/qtconcurrentrun.h>
+#include <QCollator>
+#include <QMutex>
+#include <QRegularExpression>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+#include "dictionarymanager.h"
+#include "imagecache.h"
+#include "mobidict.h"
+
+namespace {
+
+// Matches of one dictionary with their sort keys, in the order of the keys
+typedef struct {
+  QStringList words;
+  std::vector<QCollatorSortKey> keys;
+} MatchList;
+
+// Matches of each dictionary as they are found, in any order
+typedef struct {
+  QMutex mutex;
+  QWaitCondition arrived;
+  QList<MatchList> lists;
+} MatchQueue;
+
+QStringList dictionaryMatches(const MobiDict* dict, const QString& word,
+                              DictionaryManager::MatchMode mode)
+{
+  // Headwords are decoded one at a time, only the matches are kept
+  if (mode == DictionaryManager::RegexMatch || word.isEmpty()) {
+    QRegularExpression re(word, QRegularExpression::CaseInsensitiveOption);
+    if (!re.isValid())
+      return QStringList();
+
+    QStringList result;
+    for (int rank = 0; rank < dict->wordCount(); ++rank) {
+      const QString headword = dict->word(rank);
+      if (word.isEmpty() || re.match(headword).hasMatch())
+        result.append(headword);
+    }
+
+    return result;
+  }
+
+  if (mode == DictionaryManager::TextMatch)
+    return dict->words(dict->searchText(word));
+
+  const PrefixIndex& index = dict->prefixIndex();
+  return dict->words(index.ranks(index.find(PrefixIndex::fold(word))));
+}
+
+// Sort keys are computed once per word, comparing them is much cheaper than
+// collating the words again on every comparison
+MatchList sortedMatches(const QStringList& words, const QCollator& collator,
+                        bool sorted)
+{
+  std::vector<QCollatorSortKey> keys;
+  keys.reserve(words.size());
+  for (const auto& word : words)
+    keys.push_back(collator.sortKey(word));
+
+  MatchList result;
+  if (sorted) {
+    result.words = words;
+    result.keys  = std::move(keys);
+    return result;
+  }
+
+  QVector<int> order(words.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&keys](int a, int b) {
+    return keys[a].compare(keys[b]) < 0;
+  });
+
+  result.words.reserve(words.size());
+  result.keys.reserve(words.size());
+  for (int i : order) {
+    result.words.append(words[i]);
+    result.keys.push_back(keys[i]);
+  }
+
+  return result;
+}
+
+// Both lists are in the order of their keys, so a merge keeps the result
+// sorted without collating any word again
+MatchList mergeMatches(const MatchList& a, const MatchList& b)
+{
+  MatchList merged;
+  merged.words.reserve(a.words.size() + b.words.size());
+  merged.keys.reserve(a.keys.size() + b.keys.size());
+
+  int i = 0;
+  int j = 0;
+
+  while (i < a.words.size() || j < b.words.size()) {
+    const bool fromA =
+        j == b.words.size() ||
+        (i < a.words.size() && a.keys[i].compare(b.keys[j]) <= 0);
+
+    const MatchList& list = fromA ? a : b;
+    const int index       = fromA ? i++ : j++;
+
+    const QString& word = list.words[index];
+    if (merged.words.isEmpty() || merged.words.last() != word) {
+      merged.words.append(word);
+      merged.keys.push_back(list.keys[index]);
+    }
+  }
+
+  return merged;
+}
+
+}  // namespace
+
+DictionaryManager::DictionaryManager(qint64 budget, int imageBudget)
+{
+  m_budget      = budget;
+  m_usage       = 0;
+  m_imageBudget = imageBudget;
+  m_clock       = 0;
+}
+
+DictionaryManager::~DictionaryManager()
+{
+  clear();
+}
+
+void DictionaryManager::insert(const QString& name, MobiDict* dict)
+{
+  remove(name);
+
+  Resident resident;
+  resident.dict       = dict;
+  resident.imageCache = new ImageCache(dict, m_imageBudget);
+  resident.cost       = 0;
+  resident.lastUsed   = ++m_clock;
+
+  m_dictionaries.insert(name, resident);
+
+  evict(name);
+}
+
+void DictionaryManager::remove(const QString& name)
+{
+  const auto it = m_dictionaries.find(name);
+  if (it == m_dictionaries.end())
+    return;
+
+  m_usage -= it->cost;
+  delete it->imageCache;
+  delete it->dict;
+
+  m_dictionaries.erase(it);
+}
+
+void DictionaryManager::clear()
+{
+  for (const auto& name : m_dictionaries.keys())
+    remove(name);
+}
+
+MobiDict* DictionaryManager::dictionary(const QString& name)
+{
+  const auto it = m_dictionaries.find(name);
+  if (it == m_dictionaries.end())
+    return nullptr;
+
+  it->lastUsed = ++m_clock;
+  return it->dict;
+}
+
+ImageCache* DictionaryManager::imageCache(const QString& name)
+{
+  const auto it = m_dictionaries.find(name);
+  return it == m_dictionaries.end() ? nullptr : it->imageCache;
+}
+
+bool DictionaryManager::contains(const QString& name) const
+{
+  return m_dictionaries.contains(name);
+}
+
+QStringList DictionaryManager::names() const
+{
+  QStringList names = m_dictionaries.keys();
+  names.sort();
+  return names;
+}
+
+void DictionaryManager::setBudget(qint64 budget)
+{
+  m_budget = budget;
+
+  // Keep the most recently used one
+  QString newest;
+  quint64 lastUsed = 0;
+  for (auto it = m_dictionaries.constBegin(); it != m_dictionaries.constEnd();
+       ++it) {
+    if (it->lastUsed > lastUsed) {
+      newest   = it.key();
+      lastUsed = it->lastUsed;
+    }
+  }
+
+  evict(newest);
+}
+
+qint64 DictionaryManager::budget() const
+{
+  return m_budget;
+}
+
+qint64 DictionaryManager::usage() const
+{
+  return m_usage;
+}
+
+void DictionaryManager::matches(const QString& word, MatchMode mode,
+                                const MatchCallback& report) const
+{
+  QList<const MobiDict*> dicts;
+  for (const auto& name : names())
+    dicts.append(m_dictionaries[name].dict);
+
+  if (dicts.isEmpty())
+    return;
+
+  if (dicts.size() == 1) {
+    report(dictionaryMatches(dicts.first(), word, mode));
+    return;
+  }
+
+  // Merged in the order of the first dictionary, the matches of dictionaries
+  // in other languages are sorted again to fit in
+  const MobiDict* first = dicts.first();
+  const auto queue      = std::make_shared<MatchQueue>();
+
+  for (const MobiDict* dict : dicts) {
+    std::function<void()> match = [queue, first, dict, word, mode]() {
+      const QCollator order = first->collator();
+      const MatchList list =
+          sortedMatches(dictionaryMatches(dict, word, mode), order,
+                        dict->collator().locale() == order.locale());
+
+      QMutexLocker locker(&queue->mutex);
+      queue->lists.append(list);
+      queue->arrived.wakeOne();
+    };
+
+    QtConcurrent::run(match);
+  }
+
+  MatchList merged;
+
+  for (int received = 0; received < dicts.size(); ++received) {
+    MatchList list;
+
+    {
+      QMutexLocker locker(&queue->mutex);
+
+      // The dictionaries may be waiting for this very thread of the pool
+      while (queue->lists.isEmpty()) {
+        QThreadPool::globalInstance()->releaseThread();
+        queue->arrived.wait(&queue->mutex);
+        QThreadPool::globalInstance()->reserveThread();
+      }
+
+      list = queue->lists.takeFirst();
+    }
+
+    merged = mergeMatches(merged, list);
+    report(merged.words);
+  }
+}
+
+QFuture<DictLookup> DictionaryManager::lookup(const QString& word) const
+{
+  QList<QPair<QString, const MobiDict*>> dicts;
+  for (const auto& name : names())
+    dicts.append(qMakePair(name, m_dictionaries[name].dict));
+
+  std::function<DictLookup(const QPair<QString, const MobiDict*>&)> lookup =
+      [word](const QPair<QString, const MobiDict*>& dict) {
+        DictLookup result;
+        result.dictionary = dict.first;
+        result.html       = dict.second->lookupWord(word, &result.resources);
+        return result;
+      };
+
+  return QtConcurrent::mapped(dicts, lookup);
+}
+
+QStringList DictionaryManager::suggestions(const QString& word,
+                                           int limit) const
+{
+  // Rank the suggestions of every dictionary together by their distance
+  const QString folded = PrefixIndex::fold(word);
+  QList<QPair<int, QString>> candidates;
+
+  for (const auto& name : names()) {
+    for (const auto& s : m_dictionaries[name].dict->suggestions(word, limit)) {
+      const int d = FuzzyIndex::distance(folded, PrefixIndex::fold(s), INT_MAX);
+      candidates.append(qMakePair(d, s));
+    }
+  }
+
+  std::stable_sort(candidates.begin(), candidates.end(),
+                   [](const QPair<int, QString>& a,
+                      const QPair<int, QString>& b) {
+                     return a.first < b.first;
+                   });
+
+  QStringList result;
+  for (const auto& candidate : candidates) {
+    if (result.size() == limit)
+      break;
+
+    if (!result.contains(candidate.second))
+      result.append(candidate.second);
+  }
+
+  return result;
+}
+
+void DictionaryManager::buildTextIndexes()
+{
+  for (const auto& resident : m_dictionaries)
+    resident.dict->buildTextIndex();
+}
+
+bool DictionaryManager::textIndexesReady() const
+{
+  for (const auto& resident : m_dictionaries) {
+    if (!resident.dict->isTextIndexReady())
+      return false;
+  }
+
+  return true;
+}
+
+void DictionaryManager::updateCosts()
+{
+  // Text and inflection indexes are built after the dictionaries are added
+  m_usage = 0;
+
+  for (auto& resident : m_dictionaries) {
+    resident.cost = resident.dict->memoryUsage();
+    m_usage += resident.cost;
+  }
+}
+
+void DictionaryManager::evict(const QString& keep)
+{
+  updateCosts();
+
+  while (m_usage > m_budget && m_dictionaries.size() > 1) {
+    QString oldest;
+    quint64 lastUsed = std::numeric_limits<quint64>::max();
+
+    for (auto it = m_dictionaries.constBegin();
+         it != m_dictionaries.constEnd(); ++it) {
+      if (it.key() != keep && it->lastUsed < lastUsed) {
+        oldest   = it.key();
+        lastUsed = it->lastUsed;
+      }
+    }
+
+    remove(oldest);
+  }
+}
@@ -0,0 +1,75 @@
+#ifndef DICTIONARYMANAGER_H
+#define DICTIONARYMANAGER_H
+
+#include <QFuture>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+#include <functional>
+
+class ImageCache;
+class MobiDict;
+
+typedef struct {
+  QString dictionary;
+  QString html;
+  QStringList resources;
+} DictLookup;
+
+// Keeps opened dictionaries resident so that switching between them does not
+// reparse them from disk.
+//
+// Dictionaries are charged their estimated memory usage against a budget and
+// the least recently used ones are evicted when it is exceeded. The most
+// recently inserted one is always kept, however large it is.
+class DictionaryManager {
+ public:
+  enum MatchMode { PrefixMatch, RegexMatch, TextMatch };
+
+  typedef std::function<void(const QStringList&)> MatchCallback;
+
+  DictionaryManager(qint64 budget, int imageBudget);
+  ~DictionaryManager();
+
+  void insert(const QString& name, MobiDict*);
+  void remove(const QString& name);
+  void clear();
+
+  MobiDict* dictionary(const QString& name);
+  ImageCache* imageCache(const QString& name);
+  bool contains(const QString& name) const;
+  QStringList names() const;
+
+  void setBudget(qint64 budget);
+  qint64 budget() const;
+  qint64 usage() const;
+
+  // Across every resident dictionary. Matches are merged as each dictionary
+  // finds its own, and every merged list so far is passed to report.
+  void matches(const QString& word, MatchMode mode,
+               const MatchCallback& report) const;
+  QFuture<DictLookup> lookup(const QString& word) const;
+  QStringList suggestions(const QString& word, int limit) const;
+  void buildTextIndexes();
+  bool textIndexesReady() const;
+
+ private:
+  typedef struct {
+    MobiDict* dict;
+    ImageCache* imageCache;
+    qint64 cost;
+    quint64 lastUsed;
+  } Resident;
+
+  void updateCosts();
+  void evict(const QString& keep);
+
+  QHash<QString, Resident> m_dictionaries;
+  qint64 m_budget;
+  qint64 m_usage;
+  int m_imageBudget;
+  quint64 m_clock;
+};
+
+#endif
@@ -0,0 +1,118 @@
+#include "flatimage.h"
+
+namespace {
+
+qint64 align(qint64 offset)
+{
+  return (offset + 7) & ~qint64(7);
+}
+
+}  // namespace
+
+FlatImage::FlatImage(const QVector<int> &elementSizes)
+{
+  m_elementSizes = elementSizes;
+  clear();
+}
+
+void FlatImage::build(const QVector<quint32> &counts)
+{
+  const qint64 size = layout(counts.constData());
+
+  m_data = QByteArray(size, '\0');
+  memcpy(m_data.data(), counts.constData(), counts.size() * sizeof(quint32));
+  m_base = reinterpret_cast<const uchar *>(m_data.constData());
+}
+
+bool FlatImage::attach(const uchar *data, qint64 size)
+{
+  if (data != reinterpret_cast<const uchar *>(m_data.constData()))
+    m_data.clear();
+
+  const int sections = m_elementSizes.size();
+  if (size < qint64(sections * sizeof(quint32))) {
+    clear();
+    return false;
+  }
+
+  QVector<quint32> counts(sections);
+  memcpy(counts.data(), data, sections * sizeof(quint32));
+
+  if (layout(counts.constData()) != size) {
+    clear();
+    return false;
+  }
+
+  m_base = data;
+  return true;
+}
+
+void FlatImage::clear()
+{
+  m_data.clear();
+
+  m_counts.fill(0, m_elementSizes.size());
+  m_offsets.fill(0, m_elementSizes.size());
+  m_base = nullptr;
+}
+
+quint32 FlatImage::count(int section) const
+{
+  return m_counts[section];
+}
+
+const QByteArray &FlatImage::data() const
+{
+  return m_data;
+}
+
+quint32 FlatImage::tableSize(quint32 count)
+{
+  quint32 size = 1;
+  while (size < 2 * count)
+    size <<= 1;
+
+  return size;
+}
+
+bool FlatImage::isValidTable(const qint32 *table, quint32 size, quint32 count)
+{
+  if (size == 0 || (size & (size - 1)) != 0 || size <= count)
+    return false;
+
+  quint32 freeSlots = 0;
+  for (quint32 i = 0; i < size; ++i) {
+    if (table[i] < -1 || table[i] >= qint64(count))
+      return false;
+
+    if (table[i] == -1)
+      ++freeSlots;
+  }
+
+  return freeSlots > 0;
+}
+
+quint32 FlatImage::hash(const QChar *chars, int length)
+{
+  quint32 h = 2166136261u;
+  for (int i = 0; i < length; ++i) {
+    h ^= chars[i].unicode();
+    h *= 16777619u;
+  }
+
+  return h;
+}
+
+qint64 FlatImage::layout(const quint32 *counts)
+{
+  const int sections = m_elementSizes.size();
+  qint64 offset      = align(sections * sizeof(quint32));
+
+  for (int i = 0; i < sections; ++i) {
+    m_counts[i]  = counts[i];
+    m_offsets[i] = offset;
+    offset       = align(offset + qint64(counts[i]) * m_elementSizes[i]);
+  }
+
+  return offset;
+}
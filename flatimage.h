@@ -0,0 +1,128 @@
+#ifndef FLATIMAGE_H
+#define FLATIMAGE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include <algorithm>
+#include <cstring>
+
+// One contiguous block of arrays, built in memory or used straight from a
+// memory mapped file. Shared by WordStore, InflectionIndex and TextIndex.
+//
+//   quint32[sections] | section 0 | section 1 | ...
+//
+// The header holds the element count of each section, their element sizes are
+// fixed by the owner. Sections start on 8 byte boundaries, and a section with
+// an element size of 0 only keeps its count.
+//
+// Strings live in a QChar pool section and are referenced by elements with
+// poolOffset and length members. Tables are open-addressing hashes from such
+// strings to their element index, probed linearly.
+class FlatImage {
+ public:
+  explicit FlatImage(const QVector<int>& elementSizes);
+
+  // Allocates a zeroed image, to be filled through data()
+  void build(const QVector<quint32>& counts);
+  bool attach(const uchar* data, qint64 size);
+  void clear();
+
+  quint32 count(int section) const;
+
+  template <typename T>
+  const T* section(int i) const
+  {
+    return reinterpret_cast<const T*>(m_base + m_offsets[i]);
+  }
+
+  // Only valid on an image made by build()
+  template <typename T>
+  T* data(int i)
+  {
+    return reinterpret_cast<T*>(m_data.data() + m_offsets[i]);
+  }
+
+  const QByteArray& data() const;
+
+  // Whether every element's [first, first + length) lies within total
+  template <typename T>
+  static bool isValid(const T* elements, quint32 count, quint32 T::*first,
+                      quint32 T::*length, quint32 total)
+  {
+    for (quint32 i = 0; i < count; ++i) {
+      if (qint64(elements[i].*first) + elements[i].*length > total)
+        return false;
+    }
+
+    return true;
+  }
+
+  // A power of two, at least twice the count
+  static quint32 tableSize(quint32 count);
+
+  // Entries in -1..count with at least one free slot, a table without any
+  // would never end probing for a missing key
+  static bool isValidTable(const qint32* table, quint32 size, quint32 count);
+
+  // FNV-1a over UTF-16 code units, stable across Qt versions since tables
+  // using it are persisted
+  static quint32 hash(const QChar*, int length);
+
+  template <typename T>
+  static void buildTable(qint32* table, quint32 size, const T* elements,
+                         quint32 count, const QChar* pool)
+  {
+    const quint32 mask = size - 1;
+    std::fill(table, table + size, -1);
+
+    for (quint32 i = 0; i < count; ++i) {
+      quint32 slot = hash(pool + elements[i].poolOffset, elements[i].length);
+      slot &= mask;
+
+      while (table[slot] != -1)
+        slot = (slot + 1) & mask;
+
+      table[slot] = i;
+    }
+  }
+
+  template <typename T>
+  static int find(const qint32* table, quint32 size, const T* elements,
+                  const QChar* pool, const QString& key)
+  {
+    if (size == 0)
+      return -1;
+
+    const quint32 mask = size - 1;
+    const int length   = key.size();
+    quint32 slot       = hash(key.constData(), length) & mask;
+
+    for (;;) {
+      const qint32 index = table[slot];
+      if (index < 0)
+        return -1;
+
+      const T& e = elements[index];
+      if (int(e.length) == length &&
+          memcmp(pool + e.poolOffset, key.constData(),
+                 length * sizeof(QChar)) == 0)
+        return index;
+
+      slot = (slot + 1) & mask;
+    }
+  }
+
+ private:
+  qint64 layout(const quint32* counts);
+
+  QVector<int> m_elementSizes;
+  QVector<quint32> m_counts;
+  QVector<qint64> m_offsets;
+
+  QByteArray m_data;
+  const uchar* m_base;
+};
+
+#endif
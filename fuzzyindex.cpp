@@ -0,0 +1,170 @@
+#include <QPair>
+#include <QVarLengthArray>
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+#include "fuzzyindex.h"
+#include "prefixindex.h"
+
+// Children further from their node than this share one key, so that inserting
+// a word never needs the exact distance to words that are far apart
+static const int kDistanceCap = 8;
+
+FuzzyIndex::FuzzyIndex()
+{
+  m_keys = nullptr;
+}
+
+void FuzzyIndex::build(const PrefixIndex &keys)
+{
+  clear();
+
+  m_keys = &keys;
+
+  // Words come in collation order, which would build long chains of similar
+  // words. Insert them in a fixed pseudo-random order instead.
+  QVector<int> order(keys.count());
+  std::iota(order.begin(), order.end(), 0);
+  std::shuffle(order.begin(), order.end(), std::mt19937(1));
+
+  m_nodes.reserve(order.size());
+
+  for (int rank : order) {
+    const int index = m_nodes.size();
+    m_nodes.append({rank, 0, -1, -1});
+
+    if (index == 0)
+      continue;
+
+    const QString key = keys.key(rank);
+
+    int node = 0;
+    for (;;) {
+      const int d =
+          distance(key, keys.key(m_nodes[node].rank), kDistanceCap - 1);
+
+      int child = m_nodes[node].firstChild;
+      while (child >= 0 && m_nodes[child].distance != d)
+        child = m_nodes[child].nextSibling;
+
+      if (child < 0) {
+        m_nodes[index].distance    = d;
+        m_nodes[index].nextSibling = m_nodes[node].firstChild;
+        m_nodes[node].firstChild   = index;
+        break;
+      }
+
+      node = child;
+    }
+  }
+}
+
+void FuzzyIndex::clear()
+{
+  m_keys = nullptr;
+  m_nodes.clear();
+}
+
+bool FuzzyIndex::isEmpty() const
+{
+  return m_nodes.isEmpty();
+}
+
+QVector<int> FuzzyIndex::find(const QString &folded, int maxDistance,
+                              int limit) const
+{
+  if (m_nodes.isEmpty())
+    return QVector<int>();
+
+  QVector<QPair<int, int>> matches;  // distance, rank
+
+  QVector<int> stack;
+  stack.append(0);
+
+  while (!stack.isEmpty()) {
+    const Node &node = m_nodes[stack.takeLast()];
+
+    // Past the farthest child key plus the tolerance, every child is pruned
+    // alike and the exact distance does not matter
+    int bound = maxDistance;
+    for (int child = node.firstChild; child >= 0;
+         child = m_nodes[child].nextSibling)
+      bound = qMax(bound, m_nodes[child].distance + maxDistance);
+
+    const int d = distance(folded, m_keys->key(node.rank), bound);
+
+    if (d <= maxDistance)
+      matches.append(qMakePair(d, node.rank));
+
+    for (int child = node.firstChild; child >= 0;
+         child = m_nodes[child].nextSibling) {
+      const int key = m_nodes[child].distance;
+
+      if (key == kDistanceCap ? d + maxDistance >= key
+                              : qAbs(key - d) <= maxDistance)
+        stack.append(child);
+    }
+  }
+
+  std::sort(matches.begin(), matches.end());
+
+  QVector<int> ranks;
+  for (int i = 0; i < matches.size() && ranks.size() < limit; ++i)
+    ranks.append(matches[i].second);
+
+  return ranks;
+}
+
+int FuzzyIndex::distance(const QString &a, const QString &b, int max)
+{
+  const int m = a.size();
+  const int n = b.size();
+
+  // No distance is larger than the longer word
+  max = std::min(max, std::max(m, n));
+
+  if (qAbs(m - n) > max)
+    return max + 1;
+
+  // Two rows of the Levenshtein matrix, only within max of the diagonal since
+  // cells further away are over the limit anyway. Gives up once a whole row is
+  // over the limit.
+  const int over = max + 1;
+
+  QVarLengthArray<int, 128> rows(2 * (n + 1));
+  int *previous = rows.data();
+  int *current  = previous + n + 1;
+
+  for (int j = 0; j <= n; ++j)
+    previous[j] = std::min(j, over);
+
+  for (int i = 1; i <= m; ++i) {
+    const QChar c   = a[i - 1];
+    const int first = std::max(1, i - max);
+    const int last  = std::min(n, i + max);
+
+    current[first - 1] = first == 1 ? std::min(i, over) : over;
+    int rowBest        = current[first - 1];
+
+    for (int j = first; j <= last; ++j) {
+      const int insert  = current[j - 1] + 1;
+      const int remove  = previous[j] + 1;
+      const int replace = previous[j - 1] + (c == b[j - 1] ? 0 : 1);
+
+      current[j] = std::min(std::min(std::min(insert, remove), replace), over);
+      rowBest    = std::min(rowBest, current[j]);
+    }
+
+    if (last < n)
+      current[last + 1] = over;
+
+    if (rowBest > max)
+      return over;
+
+    std::swap(previous, current);
+  }
+
+  return previous[n];
+}
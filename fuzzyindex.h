@@ -0,0 +1,46 @@
+#ifndef FUZZYINDEX_H
+#define FUZZYINDEX_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class PrefixIndex;
+
+// Edit distance search over the headwords of a dictionary, used to suggest
+// words when a lookup misses.
+//
+// A BK-tree over the case folded headwords: each node keeps its children
+// keyed by their Levenshtein distance to it, so by the triangle inequality a
+// query only descends into children whose key is within the tolerance of the
+// query's distance to the node.
+//
+// The folded headwords are the keys of the PrefixIndex the tree is built from,
+// which must outlive it.
+class FuzzyIndex {
+ public:
+  FuzzyIndex();
+
+  void build(const PrefixIndex&);
+  void clear();
+  bool isEmpty() const;
+
+  // Ranks of the closest words, by distance and then by rank
+  QVector<int> find(const QString& folded, int maxDistance, int limit) const;
+
+  // Exact up to max, max + 1 for anything further
+  static int distance(const QString& a, const QString& b, int max);
+
+ private:
+  typedef struct {
+    int rank;
+    int distance;
+    int firstChild;
+    int nextSibling;
+  } Node;
+
+  const PrefixIndex* m_keys;
+  QVector<Node> m_nodes;
+};
+
+#endif
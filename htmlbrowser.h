@@ -1,6 +1,8 @@
 #ifndef HTMLBROWSER_H
 #define HTMLBROWSER_H
 
+#include <QHash>
+#include <QImage>
 #include <QTextBrowser>
 #include <QUrl>
 #include <QVariant>
@@ -10,16 +12,15 @@ class HtmlBrowser : public QTextBrowser {
 
  public:
   HtmlBrowser(QWidget* parent);
-  ~HtmlBrowser();
 
   void setText(const QString&);
-  void setResourceMap(QMap<QString, QImage*>);
+  void setResourceMap(const QHash<QString, QImage>&);
 
  protected:
   QVariant loadResource(int, const QUrl&) override;
 
  private:
-  QMap<QString, QImage*> m_resourceMap;
+  QHash<QString, QImage> m_resourceMap;
 };
 
 #endif
@@ -0,0 +1,98 @@
+#include <QDebug>
+#include <QMutexLocker>
+
+#include "imagecache.h"
+#include "mobidict.h"
+#include "stats.h"
+
+// QCache costs are ints, count them in KiB so large budgets do not overflow
+static int costOf(const QImage& image)
+{
+  return int(qMax<qint64>(1, image.sizeInBytes() / 1024));
+}
+
+ImageCache::ImageCache(MobiDict* dict, int budget)
+{
+  m_dict   = dict;
+  m_hits   = 0;
+  m_misses = 0;
+
+  setBudget(budget);
+}
+
+QImage ImageCache::image(size_t uid)
+{
+  QMutexLocker locker(&m_mutex);
+
+  const QImage* cached = m_cache.object(uid);
+  if (cached != nullptr) {
+    ++m_hits;
+    Stats::count(Stats::ImageCacheHits);
+    return *cached;
+  }
+
+  ++m_misses;
+  Stats::count(Stats::ImageCacheMisses);
+
+  // Decoded without the lock, another thread may get there first
+  locker.unlock();
+  const QImage img = decode(uid);
+  locker.relock();
+
+  if (!img.isNull() && !m_cache.contains(uid))
+    m_cache.insert(uid, new QImage(img), costOf(img));
+
+  return img;
+}
+
+void ImageCache::setBudget(int budget)
+{
+  QMutexLocker locker(&m_mutex);
+  m_cache.setMaxCost(qMax(1, budget / 1024));
+}
+
+int ImageCache::budget() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_cache.maxCost() * 1024;
+}
+
+quint64 ImageCache::hits() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_hits;
+}
+
+quint64 ImageCache::misses() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_misses;
+}
+
+QImage ImageCache::decode(size_t uid)
+{
+  ScopedTimer timer(Stats::DecodeResource);
+  QImage img;
+  MOBIPart* flow = m_dict->getResourceByUid(uid);
+
+  if (flow == nullptr) {
+    qWarning() << "Failed to get a resource for" << uid;
+    return img;
+  }
+
+  switch (flow->type) {
+    case MOBIFiletype::T_SVG:
+    case MOBIFiletype::T_JPG:
+    case MOBIFiletype::T_GIF:
+    case MOBIFiletype::T_PNG:
+    case MOBIFiletype::T_BMP:
+      if (!img.loadFromData(
+              QByteArray::fromRawData((const char*)flow->data, flow->size)))
+        qWarning() << "Failed to load image for" << uid;
+      break;
+    default:
+      break;
+  }
+
+  return img;
+}
@@ -0,0 +1,36 @@
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <QCache>
+#include <QImage>
+#include <QMutex>
+
+class MobiDict;
+
+// Byte-budgeted LRU cache of the decoded images of one dictionary, keyed by
+// resource uid. Images are implicitly shared, handing them out is cheap.
+// Safe to use from several threads, images are decoded outside of the lock.
+class ImageCache {
+ public:
+  ImageCache(MobiDict*, int budget);
+
+  QImage image(size_t uid);
+
+  void setBudget(int budget);
+  int budget() const;
+
+  quint64 hits() const;
+  quint64 misses() const;
+
+ private:
+  QImage decode(size_t uid);
+
+  MobiDict* m_dict;
+  QCache<size_t, QImage> m_cache;
+  mutable QMutex m_mutex;
+
+  quint64 m_hits;
+  quint64 m_misses;
+};
+
+#endif
@@ -0,0 +1,205 @@
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <cstring>
+
+#include "indexcache.h"
+
+namespace {
+
+const char kIndexMagic[8] = {'M', 'D', 'I', 'C', 'T', 'I', 'D', 'X'};
+const quint32 kIndexVersion   = 6;
+const quint32 kIndexByteOrder = 0x01020304;
+
+typedef struct {
+  char magic[8];
+  quint32 version;
+  quint32 byteOrder;
+  qint64 fileSize;
+  qint64 modified;
+  char serialHash[20];
+  quint32 imageCount;
+} IndexHeader;
+
+static_assert(sizeof(IndexHeader) % 8 == 0, "IndexHeader must stay aligned");
+
+qint64 align(qint64 offset)
+{
+  return (offset + 7) & ~qint64(7);
+}
+
+}  // namespace
+
+IndexCache::IndexCache(const QString &dictPath, const QString &serial,
+                       const QString &extension)
+{
+  m_data     = nullptr;
+  m_dictPath = dictPath;
+  m_size     = 0;
+
+  m_serialHash =
+      QCryptographicHash::hash(serial.toLatin1(), QCryptographicHash::Sha1);
+
+  const QByteArray pathHash = QCryptographicHash::hash(
+      QFileInfo(dictPath).absoluteFilePath().toUtf8(),
+      QCryptographicHash::Sha1);
+
+  m_fileName = QString("%1/index/%2.%3")
+                   .arg(QStandardPaths::writableLocation(
+                       QStandardPaths::CacheLocation))
+                   .arg(QString::fromLatin1(pathHash.toHex()))
+                   .arg(extension);
+}
+
+IndexCache::~IndexCache()
+{
+  close();
+}
+
+bool IndexCache::open()
+{
+  close();
+
+  const QFileInfo info(m_dictPath);
+  m_file.setFileName(m_fileName);
+
+  if (!m_file.open(QIODevice::ReadOnly))
+    return false;
+
+  m_size = m_file.size();
+  if (m_size < qint64(sizeof(IndexHeader))) {
+    close();
+    return false;
+  }
+
+  m_data = m_file.map(0, m_size);
+  if (m_data == nullptr) {
+    close();
+    return false;
+  }
+
+  const IndexHeader *h = reinterpret_cast<const IndexHeader *>(m_data);
+
+  if (memcmp(h->magic, kIndexMagic, sizeof(kIndexMagic)) != 0 ||
+      h->version != kIndexVersion || h->byteOrder != kIndexByteOrder ||
+      h->fileSize != info.size() ||
+      h->modified != info.lastModified().toMSecsSinceEpoch() ||
+      memcmp(h->serialHash, m_serialHash.constData(), sizeof(h->serialHash)) !=
+          0) {
+    close();
+    return false;
+  }
+
+  // Every image where the sizes say, up to the end of the file
+  const qint64 *sizes = reinterpret_cast<const qint64 *>(h + 1);
+  qint64 offset       = sizeof(IndexHeader) + qint64(h->imageCount) * 8;
+
+  for (quint32 i = 0; i < h->imageCount && offset <= m_size; ++i) {
+    if (sizes[i] < 0 || sizes[i] > m_size) {
+      close();
+      return false;
+    }
+
+    m_offsets.append(offset);
+    m_sizes.append(sizes[i]);
+    offset = align(offset + sizes[i]);
+  }
+
+  if (offset != m_size) {
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+void IndexCache::close()
+{
+  if (m_data != nullptr)
+    m_file.unmap(const_cast<uchar *>(m_data));
+
+  m_file.close();
+  m_data = nullptr;
+  m_size = 0;
+  m_offsets.clear();
+  m_sizes.clear();
+}
+
+bool IndexCache::isOpen() const
+{
+  return m_data != nullptr;
+}
+
+int IndexCache::imageCount() const
+{
+  return m_sizes.size();
+}
+
+const uchar *IndexCache::imageData(int index) const
+{
+  return m_data + m_offsets[index];
+}
+
+qint64 IndexCache::imageSize(int index) const
+{
+  return m_sizes[index];
+}
+
+QByteArray IndexCache::serialize(const QList<QByteArray> &images) const
+{
+  const QFileInfo info(m_dictPath);
+
+  IndexHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, kIndexMagic, sizeof(kIndexMagic));
+  memcpy(h.serialHash, m_serialHash.constData(), sizeof(h.serialHash));
+  h.version    = kIndexVersion;
+  h.byteOrder  = kIndexByteOrder;
+  h.fileSize   = info.size();
+  h.modified   = info.lastModified().toMSecsSinceEpoch();
+  h.imageCount = images.size();
+
+  qint64 size = sizeof(h) + qint64(images.size()) * 8;
+  for (const auto &image : images)
+    size = align(size + image.size());
+
+  QByteArray data;
+  data.reserve(size);
+  data.append(reinterpret_cast<const char *>(&h), sizeof(h));
+
+  for (const auto &image : images) {
+    const qint64 imageSize = image.size();
+    data.append(reinterpret_cast<const char *>(&imageSize), sizeof(imageSize));
+  }
+
+  for (const auto &image : images) {
+    data.append(image);
+    data.append(QByteArray(align(data.size()) - data.size(), '\0'));
+  }
+
+  return data;
+}
+
+bool IndexCache::save(const QString &fileName, const QByteArray &data)
+{
+  QDir().mkpath(QFileInfo(fileName).absolutePath());
+
+  QSaveFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly)) {
+    qWarning() << "Failed to write index cache" << fileName;
+    return false;
+  }
+
+  file.write(data);
+  return file.commit();
+}
+
+const QString &IndexCache::fileName() const
+{
+  return m_fileName;
+}
@@ -0,0 +1,52 @@
+#ifndef INDEXCACHE_H
+#define INDEXCACHE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+// On-disk sidecar holding the decoded headwords of a dictionary together with
+// their entry ranges and prefix index, so that warm starts can skip parsing
+// the ORTH index and indexing its labels, and checking its text records.
+//
+// The file is native-endian and meant to be memory mapped: an IndexHeader,
+// the size of each image, then the images themselves on 8 byte boundaries,
+// used in place. Other per-dictionary images, such as the full-text index,
+// are kept the same way under their own extension.
+//
+// The file is keyed by the dictionary path (file name), size, modification
+// time and the device serial used to decrypt it.
+class IndexCache {
+ public:
+  IndexCache(const QString& dictPath, const QString& serial,
+             const QString& extension = "idx");
+  ~IndexCache();
+
+  bool open();
+  void close();
+  bool isOpen() const;
+
+  int imageCount() const;
+  const uchar* imageData(int index = 0) const;
+  qint64 imageSize(int index = 0) const;
+
+  QByteArray serialize(const QList<QByteArray>& images) const;
+  const QString& fileName() const;
+
+  static bool save(const QString& fileName, const QByteArray&);
+
+ private:
+  QString m_dictPath;
+  QString m_fileName;
+  QByteArray m_serialHash;
+
+  QFile m_file;
+  const uchar* m_data;
+  qint64 m_size;
+  QVector<qint64> m_offsets;
+  QVector<qint64> m_sizes;
+};
+
+#endif
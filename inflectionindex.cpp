@@ -0,0 +1,168 @@
+#include <QHash>
+
+#include <algorithm>
+#include <cstring>
+
+#include "inflectionindex.h"
+#include "prefixindex.h"
+
+namespace {
+
+enum { Forms, Targets, Table, Pool };
+
+}  // namespace
+
+InflectionIndex::InflectionIndex()
+    : m_image({sizeof(InflectedForm), sizeof(InflectionTarget), sizeof(qint32),
+               sizeof(QChar)})
+{
+  clear();
+}
+
+void InflectionIndex::build(const QStringList &forms,
+                            const QStringList &headwords)
+{
+  clear();
+
+  // Forms that fold to their own headword are found without any help
+  QHash<QString, QStringList> targets;
+  for (int i = 0; i < forms.size(); ++i) {
+    const QString form = PrefixIndex::fold(forms[i]);
+    if (form.isEmpty() || form == PrefixIndex::fold(headwords[i]))
+      continue;
+
+    QStringList &list = targets[form];
+    if (!list.contains(headwords[i]))
+      list.append(headwords[i]);
+  }
+
+  QStringList keys = targets.keys();
+  std::sort(keys.begin(), keys.end());
+
+  const quint32 formCount = keys.size();
+  quint32 targetCount     = 0;
+  quint32 poolSize        = 0;
+
+  for (const auto &key : keys) {
+    poolSize += key.size();
+
+    for (const auto &headword : targets[key]) {
+      poolSize += headword.size();
+      ++targetCount;
+    }
+  }
+
+  m_image.build({formCount, targetCount, FlatImage::tableSize(formCount),
+                 poolSize});
+
+  InflectedForm *outForms      = m_image.data<InflectedForm>(Forms);
+  InflectionTarget *outTargets = m_image.data<InflectionTarget>(Targets);
+  QChar *pool                  = m_image.data<QChar>(Pool);
+
+  quint32 poolOffset   = 0;
+  quint32 targetOffset = 0;
+
+  const auto append = [pool, &poolOffset](const QString &s) {
+    memcpy(pool + poolOffset, s.constData(), s.size() * sizeof(QChar));
+    poolOffset += s.size();
+  };
+
+  for (int i = 0; i < keys.size(); ++i) {
+    const QStringList &list = targets[keys[i]];
+
+    InflectedForm &f = outForms[i];
+    f.poolOffset     = poolOffset;
+    f.length         = keys[i].size();
+    f.firstHeadword  = targetOffset;
+    f.headwordCount  = list.size();
+    append(keys[i]);
+
+    for (const auto &headword : list) {
+      InflectionTarget &t = outTargets[targetOffset++];
+      t.poolOffset        = poolOffset;
+      t.length            = headword.size();
+      append(headword);
+    }
+  }
+
+  FlatImage::buildTable(m_image.data<qint32>(Table), m_image.count(Table),
+                        outForms, formCount, pool);
+
+  const QByteArray &data = m_image.data();
+  attach(reinterpret_cast<const uchar *>(data.constData()), data.size());
+}
+
+bool InflectionIndex::attach(const uchar *data, qint64 size)
+{
+  if (!m_image.attach(data, size))
+    return false;
+
+  const quint32 formCount   = m_image.count(Forms);
+  const quint32 targetCount = m_image.count(Targets);
+  const quint32 tableSize   = m_image.count(Table);
+  const quint32 poolSize    = m_image.count(Pool);
+
+  const InflectedForm *forms      = m_image.section<InflectedForm>(Forms);
+  const InflectionTarget *targets = m_image.section<InflectionTarget>(Targets);
+  const qint32 *table             = m_image.section<qint32>(Table);
+
+  if (!FlatImage::isValid(forms, formCount, &InflectedForm::poolOffset,
+                          &InflectedForm::length, poolSize) ||
+      !FlatImage::isValid(forms, formCount, &InflectedForm::firstHeadword,
+                          &InflectedForm::headwordCount, targetCount) ||
+      !FlatImage::isValid(targets, targetCount, &InflectionTarget::poolOffset,
+                          &InflectionTarget::length, poolSize) ||
+      !FlatImage::isValidTable(table, tableSize, formCount)) {
+    clear();
+    return false;
+  }
+
+  m_forms     = forms;
+  m_targets   = targets;
+  m_table     = table;
+  m_pool      = m_image.section<QChar>(Pool);
+  m_formCount = formCount;
+  m_tableSize = tableSize;
+
+  return true;
+}
+
+void InflectionIndex::clear()
+{
+  m_image.clear();
+
+  m_forms     = nullptr;
+  m_targets   = nullptr;
+  m_table     = nullptr;
+  m_pool      = nullptr;
+  m_formCount = 0;
+  m_tableSize = 0;
+}
+
+int InflectionIndex::count() const
+{
+  return m_formCount;
+}
+
+QStringList InflectionIndex::headwords(const QString &word) const
+{
+  const int index = FlatImage::find(m_table, m_tableSize, m_forms, m_pool,
+                                    PrefixIndex::fold(word));
+  if (index < 0)
+    return QStringList();
+
+  const InflectedForm &f = m_forms[index];
+
+  QStringList result;
+  for (quint32 i = 0; i < f.headwordCount; ++i) {
+    const InflectionTarget &t = m_targets[f.firstHeadword + i];
+    result.append(QString(m_pool + t.poolOffset, t.length));
+  }
+
+  return result;
+}
+
+const QByteArray &InflectionIndex::data() const
+{
+  return m_image.data();
+}
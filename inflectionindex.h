@@ -0,0 +1,60 @@
+#ifndef INFLECTIONINDEX_H
+#define INFLECTIONINDEX_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+#include "flatimage.h"
+
+typedef struct {
+  quint32 poolOffset;
+  quint32 length;
+  quint32 firstHeadword;
+  quint32 headwordCount;
+} InflectedForm;
+
+typedef struct {
+  quint32 poolOffset;
+  quint32 length;
+} InflectionTarget;
+
+// Inflected forms of the headwords of a dictionary, decoded from its INFL
+// index, such as "went" for "go" or "children" for "child".
+//
+// Like WordStore, everything lives in one FlatImage that can be used from a
+// memory mapped file:
+//
+//   InflectedForm[forms] | InflectionTarget[targets] | qint32[table] |
+//   QChar[pool]
+//
+// Forms are folded (see PrefixIndex::fold()), each pointing to the run of
+// headwords it is an inflection of. The table is an open-addressing hash from
+// form to its index.
+class InflectionIndex {
+ public:
+  InflectionIndex();
+
+  // Pairs of an inflected form and its headword, in any order
+  void build(const QStringList& forms, const QStringList& headwords);
+  bool attach(const uchar* data, qint64 size);
+  void clear();
+
+  int count() const;
+  QStringList headwords(const QString& word) const;
+
+  const QByteArray& data() const;
+
+ private:
+  FlatImage m_image;
+
+  const InflectedForm* m_forms;
+  const InflectionTarget* m_targets;
+  const qint32* m_table;
+  const QChar* m_pool;
+
+  quint32 m_formCount;
+  quint32 m_tableSize;
+};
+
+#endif
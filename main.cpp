@@ -1,5 +1,8 @@
 #include <QApplication>
+#include <QStandardPaths>
+
 #include "mainwindow.h"
+#include "stats.h"
 
 int main(int argc, char **argv)
 {
@@ -14,5 +17,12 @@ int main(int argc, char **argv)
     return -1;
 
   m.show();
-  return app.exec();
+  const int result = app.exec();
+
+  // Timings of the session, for comparing runs
+  Stats::dump(QString("%1/stats.json")
+                  .arg(QStandardPaths::writableLocation(
+                      QStandardPaths::AppLocalDataLocation)));
+
+  return result;
 }
@@ -1,15 +1,18 @@
+#include <QtConcurrent/qtconcurrentmap.h>
 #include <QtConcurrent/qtconcurrentrun.h>
 #include <QApplication>
 #include <QClipboard>
 #include <QDesktopWidget>
 #include <QFileDialog>
+#include <QFutureInterface>
 #include <QKeyEvent>
 #include <QMessageBox>
 #include <QRegularExpression>
-#include <QRegularExpressionMatch>
 #include <QShortcut>
 #include <QWidget>
 
+#include <functional>
+
 #ifdef AUTOTEST
 #include <QTest>
 #define SELF_TEST
@@ -17,6 +20,128 @@
 
 #include "mainwindow.h"
 #include "settings.h"
+#include "stats.h"
+#include "statsdialog.h"
+
+static const char* kAllDictionaries     = "All dictionaries";
+static const int kSuggestionCount       = 8;
+static const int kTextIndexPollInterval = 250;
+
+// Words filtered at a time by a match computation, between checks for
+// cancellation
+static const int kMatchSlice = 4096;
+
+// The first rows are shown early, later chunks grow up to the maximum
+static const int kFirstMatchChunk = 256;
+static const int kMaxMatchChunk   = 65536;
+
+// Upper bound of the delay between typing and searching, which otherwise
+// follows the cost of the previous search
+static const int kMaxMatchDelay = 150;
+
+// Entries rendered in the background around the selected one, most of them
+// in the direction the list is browsed
+static const int kPrefetchAhead  = 3;
+static const int kPrefetchBehind = 1;
+
+namespace {
+
+// Entry cache cost, in KiB
+int entryCost(const RenderedEntry& entry)
+{
+  qint64 cost = entry.html.size() * sizeof(QChar);
+  for (const auto& img : entry.resources)
+    cost += img.sizeInBytes();
+
+  return int(qMax<qint64>(1, cost / 1024));
+}
+
+// Looks up a word and decodes its images, safe to run off the GUI thread
+RenderedEntry prepareEntry(const MobiDict* dict, ImageCache* imageCache,
+                           const QString& word)
+{
+  RenderedEntry entry;
+  QStringList resources;
+
+  entry.html = dict->lookupWord(word, &resources);
+  if (entry.html.isNull())
+    return entry;
+
+  for (const auto& uid : resources) {
+    const QImage img = imageCache->image(uid.toUInt(nullptr, 10));
+    if (!img.isNull())
+      entry.resources[uid] = img;
+  }
+
+  return entry;
+}
+
+// Hands the matches of a background computation over in growing chunks
+class MatchReporter {
+ public:
+  MatchReporter(QFutureInterface<MatchChunk>* future, quint64 generation)
+  {
+    m_future             = future;
+    m_pending.generation = generation;
+    m_pending.replace    = false;
+    m_chunkSize          = kFirstMatchChunk;
+    m_count              = 0;
+  }
+
+  bool isCanceled() const
+  {
+    return m_future->isCanceled();
+  }
+
+  void report(const QVector<int>& ranks)
+  {
+    m_pending.ranks += ranks;
+    if (m_pending.ranks.size() >= m_chunkSize)
+      flush();
+  }
+
+  void report(const QStringList& words)
+  {
+    m_pending.words += words;
+    if (m_pending.words.size() >= m_chunkSize)
+      flush();
+  }
+
+  void replace(const QStringList& words)
+  {
+    flush();
+
+    m_pending.words   = words;
+    m_pending.replace = true;
+    flush();
+    m_pending.replace = false;
+  }
+
+  void finish()
+  {
+    flush();
+    m_future->reportFinished();
+  }
+
+ private:
+  void flush()
+  {
+    if (m_pending.ranks.isEmpty() && m_pending.words.isEmpty())
+      return;
+
+    m_future->reportResult(m_pending, m_count++);
+    m_pending.ranks.clear();
+    m_pending.words.clear();
+    m_chunkSize = qMin(m_chunkSize * 4, kMaxMatchChunk);
+  }
+
+  QFutureInterface<MatchChunk>* m_future;
+  MatchChunk m_pending;
+  int m_chunkSize;
+  int m_count;
+};
+
+}  // namespace
 
 MainWindow::MainWindow() : QWidget(), m_ui(new Ui::MainWindow())
 {
@@ -24,12 +149,29 @@ MainWindow::MainWindow() : QWidget(), m_ui(new Ui::MainWindow())
   m_ui->splitter->setStretchFactor(0, 2);
   m_ui->splitter->setStretchFactor(1, 8);
 
-  m_currentDict     = nullptr;
-  m_currentDictName = QString::null;
-  m_deviceSerial    = QString::null;
-  m_html            = QString::null;
-
-  m_model = new QStringListModel;
+  m_allDictionaries  = false;
+  m_currentDict      = nullptr;
+  m_currentDictName  = QString::null;
+  m_deviceSerial     = QString::null;
+  m_imageCache       = nullptr;
+  m_loadingDict      = nullptr;
+  m_loadingImages    = nullptr;
+  m_publishedWords   = 0;
+  m_historyIndex     = -1;
+  m_historyTransient = false;
+  m_html             = QString::null;
+  m_regexSearch      = false;
+  m_fullTextSearch   = false;
+  m_matchGeneration  = 0;
+  m_matchCost        = 0;
+  m_matchesShown     = false;
+  m_selectFirstMatch = false;
+  m_browseRow        = -1;
+  m_browseDirection  = 1;
+  m_lastPrefix       = QString::null;
+  m_lastRange        = {0, 0};
+
+  m_model = new MatchesModel;
   m_ui->matchesView->setModel(m_model);
   m_ui->matchesView->setUniformItemSizes(true);
   m_ui->matchesView->setEditTriggers(QAbstractItemView::NoEditTriggers);
@@ -57,17 +199,25 @@ MainWindow::MainWindow() : QWidget(), m_ui(new Ui::MainWindow())
   m_emojiFont = "Apple Color Emoji";
 #endif
 
+  m_dictionaries = new DictionaryManager(
+      m_settings->value("viewer/residentDictionariesSize", 1024).toLongLong() *
+          1024 * 1024,
+      m_settings->value("viewer/imageCacheSize", 64).toInt() * 1024 * 1024);
+
+  // Cost is in KiB
+  m_entryCache.setMaxCost(
+      m_settings->value("viewer/entryCacheSize", 32).toInt() * 1024);
+
   m_settingsDialog = new Settings(this, m_settings);
+  m_statsDialog    = new StatsDialog(this);
   m_ui->searchLine->installEventFilter(this);
 
   connect(m_ui->searchLine, &QLineEdit::returnPressed, this,
           &MainWindow::searchWord);
   connect(m_ui->searchLine, &QLineEdit::textChanged, this,
-          &MainWindow::loadMatches);
+          &MainWindow::scheduleMatches);
   connect(m_ui->matchesView, &QListView::activated, this,
           &MainWindow::searchItem);
-  connect(m_ui->matchesView, &QListView::clicked, this,
-          &MainWindow::searchItem);
   connect(m_ui->matchesView, &QListView::doubleClicked, this,
           &MainWindow::copyWordToClipboard);
   connect(m_ui->matchesView->selectionModel(),
@@ -81,14 +231,47 @@ MainWindow::MainWindow() : QWidget(), m_ui(new Ui::MainWindow())
       this, &MainWindow::loadDictionary);
   connect(&m_watcher, &QFutureWatcher<bool>::finished, this,
           &MainWindow::dictionaryLoaded);
+  connect(&m_lookupWatcher, &QFutureWatcher<DictLookup>::resultReadyAt, this,
+          &MainWindow::lookupResultReady);
+  connect(&m_lookupWatcher, &QFutureWatcher<DictLookup>::finished, this,
+          &MainWindow::lookupFinished);
   connect(m_ui->settingsButton, &QAbstractButton::clicked, this,
           &MainWindow::showSettingsDialog);
+  connect(m_ui->fullTextButton, &QAbstractButton::toggled, this,
+          &MainWindow::setFullTextSearch);
+  connect(&m_matchWatcher, &QFutureWatcher<MatchChunk>::resultReadyAt, this,
+          &MainWindow::matchesReady);
+  connect(&m_matchWatcher, &QFutureWatcher<MatchChunk>::finished, this,
+          &MainWindow::matchesFinished);
+  connect(&m_prefetchWatcher,
+          &QFutureWatcher<PrefetchedEntry>::resultReadyAt, this,
+          &MainWindow::prefetchReady);
+
+  m_matchTimer.setSingleShot(true);
+  connect(&m_matchTimer, &QTimer::timeout, this,
+          [this]() { loadMatches(m_ui->searchLine->text()); });
+
+  // Only the newest of the selections made while the GUI was busy is shown,
+  // holding an arrow key does not queue up renders
+  m_browseTimer.setSingleShot(true);
+  connect(&m_browseTimer, &QTimer::timeout, this, &MainWindow::browseEntry);
+
+  // Text indexes are built in the background, see startTextIndexing()
+  m_textIndexTimer.setInterval(kTextIndexPollInterval);
+  connect(&m_textIndexTimer, &QTimer::timeout, this,
+          &MainWindow::checkTextIndexes);
 
   new QShortcut(QKeySequence(Qt::Key_Escape), this, SLOT(clearAndFocus()));
   new QShortcut(QKeySequence(Qt::CTRL + Qt::Key_L), m_ui->searchLine,
                 SLOT(setFocus()));
   new QShortcut(QKeySequence(Qt::CTRL + Qt::Key_M), m_ui->matchesView,
                 SLOT(setFocus()));
+  new QShortcut(QKeySequence(Qt::CTRL + Qt::Key_F), m_ui->fullTextButton,
+                SLOT(toggle()));
+  new QShortcut(QKeySequence(Qt::CTRL + Qt::SHIFT + Qt::Key_S), this,
+                SLOT(showStatsDialog()));
+  new QShortcut(QKeySequence::Back, this, SLOT(goBack()));
+  new QShortcut(QKeySequence::Forward, this, SLOT(goForward()));
 
 #ifdef Q_OS_OSX
   m_ui->matchesView->setAttribute(Qt::WA_MacShowFocusRect, 0);
@@ -100,8 +283,25 @@ MainWindow::~MainWindow()
   delete m_ui;
   m_ui = nullptr;
 
-  delete m_currentDict;
-  m_currentDict = nullptr;
+  cancelLookup();
+  cancelMatches();
+  cancelPrefetch();
+
+  if (m_loadingDict != nullptr)
+    m_loadingDict->cancel();
+
+  m_future.waitForFinished();
+
+  delete m_loadingImages;
+  m_loadingImages = nullptr;
+
+  delete m_loadingDict;
+  m_loadingDict = nullptr;
+
+  delete m_dictionaries;
+  m_dictionaries = nullptr;
+  m_currentDict  = nullptr;
+  m_imageCache   = nullptr;
 
   delete m_model;
   m_model = nullptr;
@@ -111,6 +311,9 @@ MainWindow::~MainWindow()
 
   delete m_settingsDialog;
   m_settingsDialog = nullptr;
+
+  delete m_statsDialog;
+  m_statsDialog = nullptr;
 }
 
 bool MainWindow::eventFilter(QObject* obj, QEvent* event)
@@ -154,8 +357,9 @@ void MainWindow::showEvent(QShowEvent* ev)
     QString lastDictionary =
         m_settings->value("viewer/lastDictionary", QString()).toString();
 
-    m_fontName = m_settings->value("viewer/fontName", "Consolas").toString();
-    m_fontSize = m_settings->value("viewer/fontSize", 18).toInt();
+    m_fontName    = m_settings->value("viewer/fontName", "Consolas").toString();
+    m_fontSize    = m_settings->value("viewer/fontSize", 18).toInt();
+    m_regexSearch = m_settings->value("viewer/regexSearch", false).toBool();
 
     QString deviceSerial =
         m_settings->value("viewer/deviceSerial", QString()).toString();
@@ -199,32 +403,151 @@ void MainWindow::dictionaryLoaded()
 {
   MOBI_RET result = m_future.result();
 
-  if (result != MOBI_SUCCESS) {
+  // Switched away from while loading, loadDictionary() already detached it
+  if (!isLoadWanted()) {
+    delete m_loadingImages;
+    m_loadingImages = nullptr;
+
+    delete m_loadingDict;
+    m_loadingDict = nullptr;
+
+    if (!m_pendingLoads.isEmpty())
+      startLoading();
+
+    return;
+  }
+
+  // Searches may be running on the partially loaded dictionary, and
+  // inserting may evict dictionaries a lookup or search is running on
+  cancelLookup();
+  cancelMatches();
+  cancelPrefetch();
+
+  if (m_currentDict == m_loadingDict) {
+    m_currentDict = nullptr;
+    m_imageCache  = nullptr;
+    m_model->setDictionary(nullptr);
+  }
+
+  delete m_loadingImages;
+  m_loadingImages = nullptr;
+
+  if (m_loadingDict->wasCanceled()) {
+    // Switched back to after it gave up, start over
+    m_pendingLoads.prepend(m_loadingName);
+    delete m_loadingDict;
+  }
+  else if (result != MOBI_SUCCESS) {
+    m_ui->searchLine->setEnabled(false);
+
     QMessageBox::critical(
-        this, "Error opening dictionary",
+        this, QString("Error opening %1").arg(m_loadingName),
         QString("Error code %1: %2").arg(result).arg(libmobi_msg(result)));
 
+    delete m_loadingDict;
+  }
+  else
+    m_dictionaries->insert(m_loadingName, m_loadingDict);
+
+  m_loadingDict = nullptr;
+
+  if (!m_pendingLoads.isEmpty())
+    startLoading();
+  else
+    dictionariesReady();
+}
+
+void MainWindow::loadingStageChanged(int stage)
+{
+  if (sender() != m_loadingDict || !isLoadWanted())
+    return;
+
+  setWindowTitle(QString("Loading %1 (%2) ...")
+                     .arg(m_loadingName)
+                     .arg(MobiDict::stageName(stage)));
+}
+
+void MainWindow::wordsPublished(int count)
+{
+  if (sender() != m_loadingDict)
+    return;
+
+  m_publishedWords = count;
+
+  // Only a single dictionary is searched while it loads
+  if (m_allDictionaries || !isLoadWanted())
+    return;
+
+  showLoadingDictionary();
+
+  // Matches fill in as more headwords come
+  scheduleMatches();
+}
+
+void MainWindow::showLoadingDictionary()
+{
+  if (m_currentDict == m_loadingDict)
+    return;
+
+  // Kept when switching away and back while loading
+  if (m_loadingImages == nullptr) {
+    m_loadingImages = new ImageCache(
+        m_loadingDict,
+        m_settings->value("viewer/imageCacheSize", 64).toInt() * 1024 * 1024);
+  }
+
+  m_currentDict = m_loadingDict;
+  m_imageCache  = m_loadingImages;
+  m_lastPrefix  = QString::null;
+
+  m_model->setDictionary(nullptr);
+  m_ui->searchLine->setEnabled(true);
+}
+
+bool MainWindow::isLoadWanted() const
+{
+  return m_allDictionaries || m_loadingName == m_currentDictName;
+}
+
+void MainWindow::dictionariesReady()
+{
+  QString title;
+
+  if (m_allDictionaries) {
+    const int count = m_dictionaries->names().size();
+    if (count > 0)
+      title = QString("%1 (%2 loaded)").arg(kAllDictionaries).arg(count);
+  }
+  else {
+    m_currentDict = m_dictionaries->dictionary(m_currentDictName);
+    m_imageCache  = m_dictionaries->imageCache(m_currentDictName);
+
+    if (m_currentDict)
+      title = m_currentDict->title();
+  }
+
+  if (title.isNull()) {
     setWindowTitle("Mobidict");
-    delete m_currentDict;
-    m_currentDict     = nullptr;
     m_currentDictName = QString::null;
   }
   else {
-    setWindowTitle(m_currentDict->title());
+    setWindowTitle(title);
     m_ui->searchLine->setEnabled(true);
 
-    // Populate the list widget
-    loadMatches(QString::null);
+    if (m_fullTextSearch)
+      startTextIndexing();
 
-    // and select the first item
-    m_ui->matchesView->setCurrentIndex(m_ui->matchesView->model()->index(0, 0));
+    // Populate the list widget and select the first item, keeping whatever
+    // was typed while the dictionary loaded
+    m_model->setDictionary(m_currentDict);
+    m_lastPrefix       = QString::null;
+    m_selectFirstMatch = true;
+    loadMatches(m_ui->searchLine->text());
 
 #ifdef SELF_TEST
     selfTest();
 #endif
   }
-
-  m_ui->dictComboBox->setEnabled(true);
 }
 
 bool MainWindow::discoverDictionaries()
@@ -249,6 +572,9 @@ bool MainWindow::discoverDictionaries()
   for (auto dict : dictionaries)
     m_ui->dictComboBox->addItem(dict);
 
+  if (dictionaries.size() > 1)
+    m_ui->dictComboBox->addItem(kAllDictionaries);
+
   return true;
 }
 
@@ -257,22 +583,85 @@ void MainWindow::loadDictionary(const QString& text)
   if (m_currentDictName == text)
     return;
 
-  if (m_currentDict)
-    delete m_currentDict;
+  cancelLookup();
+  cancelMatches();
+  cancelPrefetch();
 
+  // Decoded images belong to the dictionary being replaced
+  m_ui->resultBrowser->setResourceMap(QHash<QString, QImage>());
+  m_model->setDictionary(nullptr);
+
+  m_allDictionaries = text == kAllDictionaries;
+  m_currentDict     = nullptr;
   m_currentDictName = text;
-  m_currentDict     = new MobiDict(
-      QString("%1/Dictionaries/%2").arg(QDir::homePath()).arg(text),
-      m_deviceSerial);
-  m_future = QtConcurrent::run(m_currentDict, &MobiDict::open);
-  m_watcher.setFuture(m_future);
+  m_imageCache      = nullptr;
+  m_lastPrefix      = QString::null;
+  m_historyIndex    = -1;
+  m_history.clear();
+  m_pendingLoads.clear();
+
+  // Resident dictionaries are reused, the others are opened one by one. With
+  // a small budget opening all of them may evict some of the first ones.
+  if (m_allDictionaries) {
+    for (int i = 0; i < m_ui->dictComboBox->count(); ++i) {
+      const QString name = m_ui->dictComboBox->itemText(i);
+      if (name != kAllDictionaries && !m_dictionaries->contains(name))
+        m_pendingLoads.append(name);
+    }
+  }
+  else if (!m_dictionaries->contains(text))
+    m_pendingLoads.append(text);
+
+  // A load in flight goes on if it is still needed, otherwise it gives up
+  // at its next checkpoint and the next one starts after it
+  if (m_loadingDict != nullptr) {
+    if (m_pendingLoads.removeOne(m_loadingName))
+      m_loadingDict->resume();
+    else
+      m_loadingDict->cancel();
+  }
 
-  m_ui->searchLine->setEnabled(false);
-  m_ui->dictComboBox->setEnabled(false);
   m_ui->dictComboBox->setCurrentText(text);
   m_ui->resultBrowser->clear();
 
-  setWindowTitle(QString("Loading %1 ...").arg(text));
+  if (m_loadingDict != nullptr && isLoadWanted()) {
+    m_ui->searchLine->setEnabled(false);
+    setWindowTitle(QString("Loading %1 ...").arg(m_loadingName));
+
+    // Headwords published before switching away are searchable again
+    if (!m_allDictionaries && m_publishedWords > 0) {
+      showLoadingDictionary();
+      scheduleMatches();
+    }
+  }
+  else if (m_pendingLoads.isEmpty())
+    dictionariesReady();
+  else if (m_loadingDict == nullptr)
+    startLoading();
+  else {
+    m_ui->searchLine->setEnabled(false);
+    setWindowTitle(QString("Loading %1 ...").arg(m_pendingLoads.first()));
+  }
+}
+
+void MainWindow::startLoading()
+{
+  m_loadingName    = m_pendingLoads.takeFirst();
+  m_publishedWords = 0;
+  m_loadingDict = new MobiDict(
+      QString("%1/Dictionaries/%2").arg(QDir::homePath()).arg(m_loadingName),
+      m_deviceSerial);
+
+  connect(m_loadingDict, &MobiDict::stageChanged, this,
+          &MainWindow::loadingStageChanged);
+  connect(m_loadingDict, &MobiDict::wordsPublished, this,
+          &MainWindow::wordsPublished);
+
+  m_future = QtConcurrent::run(m_loadingDict, &MobiDict::open);
+  m_watcher.setFuture(m_future);
+
+  m_ui->searchLine->setEnabled(false);
+  setWindowTitle(QString("Loading %1 ...").arg(m_loadingName));
 }
 
 void MainWindow::searchWord()
@@ -281,101 +670,562 @@ void MainWindow::searchWord()
   if (word.isEmpty())
     return;
 
-  m_html = m_currentDict->lookupWord(word);
+  if (!showEntry(word, PushHistory))
+    showNotFound(word);
+}
 
-  if (m_html.isNull())
-    m_html = QString(
-                 "<br><br><center><font face='%1' "
-                 "size='+6'>🤔</font><br><br></span> The "
-                 "word <b>\"%2\"</b> is not found in the dictionary.</center>")
-                 .arg(m_emojiFont)
-                 .arg(word);
-  else
-    createResources(m_html);
+void MainWindow::showNotFound(const QString& word)
+{
+  m_html = QString(
+               "<br><br><center><font face='%1' "
+               "size='+6'>🤔</font><br><br></span> The "
+               "word <b>\"%2\"</b> is not found in the dictionary.</center>")
+               .arg(m_emojiFont)
+               .arg(word);
+
+  const QStringList suggestions =
+      m_allDictionaries
+          ? m_dictionaries->suggestions(word, kSuggestionCount)
+          : m_currentDict->suggestions(word, kSuggestionCount);
+
+  if (!suggestions.isEmpty()) {
+    QStringList links;
+    for (const auto& suggestion : suggestions) {
+      QUrl url;
+      url.setScheme("word");
+      url.setPath(suggestion);
+
+      links.append(QString("<a href=\"%1\">%2</a>")
+                       .arg(url.toString(QUrl::FullyEncoded).toHtmlEscaped())
+                       .arg(suggestion.toHtmlEscaped()));
+    }
+
+    m_html += QString("<br><center>Did you mean %1?</center>")
+                  .arg(links.join(", "));
+  }
 
   m_ui->resultBrowser->setHtml(m_html);
 }
 
 void MainWindow::handleSelectionChanged(const QItemSelection& selection)
 {
-  searchItem(selection.indexes().first());
+  // Updating the matches may only deselect
+  if (selection.indexes().isEmpty())
+    return;
+
+  const QModelIndex index = selection.indexes().first();
+  if (m_browseRow >= 0 && index.row() != m_browseRow)
+    m_browseDirection = index.row() > m_browseRow ? 1 : -1;
+
+  m_browseRow  = index.row();
+  m_browseWord = index.data().toString();
+  m_browseTimer.start(0);
+}
+
+void MainWindow::browseEntry()
+{
+  // Browsing the list should not flood the history
+  if (showEntry(m_browseWord, ReplaceHistory))
+    prefetch(m_browseRow, m_browseDirection);
 }
 
 void MainWindow::searchItem(const QModelIndex& index)
 {
-  m_html = m_currentDict->lookupWord(index.data().toString());
-  createResources(m_html);
+  showEntry(index.data().toString(), PushHistory);
+}
 
-  m_ui->resultBrowser->setHtml(m_html);
+void MainWindow::scheduleMatches()
+{
+  // Outdated as soon as the text changes
+  m_matchWatcher.cancel();
+
+  // Cheap searches run right away, costly ones wait for typing to pause
+  m_matchTimer.start(int(qMin<qint64>(m_matchCost, kMaxMatchDelay)));
 }
 
 void MainWindow::loadMatches(const QString& word)
 {
-  QRegularExpression regex(word, QRegularExpression::CaseInsensitiveOption);
-  QList<QString> matches;
+  m_matchTimer.stop();
+  m_matchWatcher.cancel();
 
-  if (regex.isValid())
-    matches = m_currentDict->words().filter(regex);
+  // Neighbours in the previous matches are not worth finishing
+  m_prefetchWatcher.cancel();
 
-  m_model->setStringList(matches);
-}
+  // Canceled computations may still be finishing, they are waited for before
+  // dictionaries go away
+  if (m_matchWatcher.isRunning())
+    m_staleMatches.append(m_matchWatcher.future());
 
-void MainWindow::createResources(const QString& html)
-{
-  QRegularExpression re("src=\"(\\d+)\"");
-  QMap<QString, QImage*> resourceMap;
-  size_t uid = 0;
+  for (int i = m_staleMatches.size() - 1; i >= 0; --i) {
+    if (m_staleMatches[i].isFinished())
+      m_staleMatches.removeAt(i);
+  }
+
+  const quint64 generation = ++m_matchGeneration;
+  m_matchesShown           = false;
+  m_matchClock.start();
+
+  const MobiDict* dict = m_currentDict;
+  std::function<void(MatchReporter*)> compute;
+
+  if (!m_allDictionaries && dict == nullptr) {
+    setMatches(MatchChunk());
+    return;
+  }
 
-  QRegularExpressionMatchIterator i = re.globalMatch(html);
-  while (i.hasNext()) {
-    QRegularExpressionMatch match = i.next();
-    QString word                  = match.captured(1);
+  if (m_allDictionaries) {
+    DictionaryManager::MatchMode mode = DictionaryManager::PrefixMatch;
+    if (m_fullTextSearch)
+      mode = DictionaryManager::TextMatch;
+    else if (m_regexSearch)
+      mode = DictionaryManager::RegexMatch;
+
+    const DictionaryManager* dictionaries = m_dictionaries;
+    compute = [dictionaries, word, mode](MatchReporter* reporter) {
+      dictionaries->matches(word, mode, [reporter](const QStringList& words) {
+        reporter->replace(words);
+      });
+    };
+  }
+  else if (!dict->isLoaded()) {
+    // Prefixes of the headwords published so far, until the index is built
+    compute = [dict, word](MatchReporter* reporter) {
+      reporter->report(dict->partialMatches(word));
+    };
+  }
+  else if (m_fullTextSearch && !word.isEmpty()) {
+    compute = [dict, word](MatchReporter* reporter) {
+      reporter->report(dict->searchText(word));
+    };
+  }
+  else if (m_regexSearch) {
+    QRegularExpression regex(word, QRegularExpression::CaseInsensitiveOption);
 
-    if (resourceMap.constFind(word) != resourceMap.constEnd())
-      continue;
+    if (regex.isValid()) {
+      compute = [dict, regex](MatchReporter* reporter) {
+        const int count = dict->wordCount();
 
-    uid            = word.toUInt(nullptr, 10);
-    MOBIPart* flow = m_currentDict->getResourceByUid(uid);
+        for (int begin = 0; begin < count; begin += kMatchSlice) {
+          if (reporter->isCanceled())
+            break;
 
-    if (flow != nullptr) {
-      switch (flow->type) {
-        case MOBIFiletype::T_SVG:
-        case MOBIFiletype::T_JPG:
-        case MOBIFiletype::T_GIF:
-        case MOBIFiletype::T_PNG:
-        case MOBIFiletype::T_BMP: {
-          QImage* img  = new QImage;
-          bool success = img->loadFromData(
-              QByteArray((const char*)flow->data, flow->size));
-          if (!success) {
-            qWarning() << "Failed to load image for" << match;
-            delete img;
-            img = nullptr;
+          const int end = qMin(begin + kMatchSlice, count);
+          QVector<int> ranks;
+
+          for (int rank = begin; rank < end; ++rank) {
+            if (regex.match(dict->word(rank)).hasMatch())
+              ranks.append(rank);
           }
-          else
-            resourceMap[word] = img;
-        } break;
-        default:
-          break;
-      }
+
+          reporter->report(ranks);
+        }
+      };
     }
+  }
+  else if (word.isEmpty()) {
+    // Every headword, nothing to compute
+    m_lastPrefix   = QString::null;
+    m_matchesShown = true;
+    m_model->showAll();
+    selectFirstMatch();
+    return;
+  }
+  else {
+    const PrefixIndex& index = dict->prefixIndex();
+    const QString prefix     = PrefixIndex::fold(word);
+
+    // Appending characters can only narrow down the previous matches
+    if (!m_lastPrefix.isEmpty() && prefix.startsWith(m_lastPrefix))
+      m_lastRange = index.find(prefix, m_lastRange);
     else
-      qWarning() << "Failed to get a resource for" << word;
+      m_lastRange = index.find(prefix);
+
+    m_lastPrefix = prefix;
+
+    const PrefixIndex::Range range = m_lastRange;
+    compute = [dict, range](MatchReporter* reporter) {
+      reporter->report(dict->prefixIndex().ranks(range));
+    };
+  }
+
+  if (!compute) {
+    setMatches(MatchChunk());
+    return;
+  }
+
+  QFutureInterface<MatchChunk> future;
+  future.reportStarted();
+
+  QtConcurrent::run([future, generation, compute]() mutable {
+    MatchReporter reporter(&future, generation);
+    if (!reporter.isCanceled())
+      compute(&reporter);
+
+    reporter.finish();
+  });
+
+  m_matchWatcher.setFuture(future.future());
+}
+
+void MainWindow::matchesReady(int index)
+{
+  const MatchChunk chunk = m_matchWatcher.resultAt(index);
+  if (chunk.generation != m_matchGeneration)
+    return;
+
+  if (!m_matchesShown || chunk.replace) {
+    setMatches(chunk);
+    return;
+  }
+
+  // Appended without resetting the view, which keeps the selection
+  if (chunk.ranks.isEmpty())
+    m_model->appendWords(chunk.words);
+  else
+    m_model->appendRanks(chunk.ranks);
+}
+
+void MainWindow::matchesFinished()
+{
+  if (m_matchWatcher.isCanceled())
+    return;
+
+  m_matchCost = m_matchClock.elapsed();
+  Stats::record(Stats::Matches, m_matchClock.nsecsElapsed());
+
+  if (!m_matchesShown)
+    setMatches(MatchChunk());
+}
+
+void MainWindow::setMatches(const MatchChunk& chunk)
+{
+  // The model only tells the view what changed since the previous search
+  if (chunk.ranks.isEmpty())
+    m_model->setWords(chunk.words);
+  else
+    m_model->setRanks(chunk.ranks);
+
+  m_matchesShown = true;
+  selectFirstMatch();
+}
+
+void MainWindow::selectFirstMatch()
+{
+  if (!m_selectFirstMatch)
+    return;
+
+  m_selectFirstMatch = false;
+  m_ui->matchesView->setCurrentIndex(m_model->index(0, 0));
+}
+
+void MainWindow::cancelMatches()
+{
+  m_matchTimer.stop();
+  m_matchWatcher.cancel();
+  m_matchWatcher.waitForFinished();
+
+  for (auto& future : m_staleMatches)
+    future.waitForFinished();
+
+  m_staleMatches.clear();
+}
+
+void MainWindow::prefetch(int row, int direction)
+{
+  // Not waited for, the entry being prepared may take a while and the next
+  // selection should not. They are waited for before dictionaries go away.
+  m_prefetchWatcher.cancel();
+  if (m_prefetchWatcher.isRunning())
+    m_stalePrefetches.append(m_prefetchWatcher.future());
+
+  for (int i = m_stalePrefetches.size() - 1; i >= 0; --i) {
+    if (m_stalePrefetches[i].isFinished())
+      m_stalePrefetches.removeAt(i);
+  }
+
+  // The image cache of a dictionary still loading goes away with it
+  if (m_allDictionaries || m_currentDict == nullptr ||
+      !m_currentDict->isLoaded())
+    return;
+
+  // Nearest first, they are the most likely to be shown next
+  QStringList words;
+  for (int i = 1; i <= kPrefetchAhead; ++i) {
+    words.append(m_model->index(row + i * direction, 0).data().toString());
+
+    if (i <= kPrefetchBehind)
+      words.append(m_model->index(row - i * direction, 0).data().toString());
+  }
+
+  for (int i = words.size() - 1; i >= 0; --i) {
+    if (words[i].isEmpty() || m_entryCache.contains(entryKey(words[i])))
+      words.removeAt(i);
+  }
+
+  if (words.isEmpty())
+    return;
+
+  const MobiDict* dict   = m_currentDict;
+  ImageCache* imageCache = m_imageCache;
+  const QString dictName = m_currentDictName;
+
+  std::function<PrefetchedEntry(const QString&)> prepare =
+      [dict, imageCache, dictName](const QString& word) {
+        PrefetchedEntry result;
+        result.key   = dictName + QChar('\n') + word;
+        result.entry = prepareEntry(dict, imageCache, word);
+        return result;
+      };
+
+  m_prefetchWatcher.setFuture(QtConcurrent::mapped(words, prepare));
+}
+
+void MainWindow::prefetchReady(int index)
+{
+  const PrefetchedEntry result = m_prefetchWatcher.resultAt(index);
+
+  // Shown meanwhile, or from a dictionary no longer current. Entries found
+  // while loading may lack what the full index finds, they are not kept.
+  if (result.entry.html.isNull() || m_entryCache.contains(result.key) ||
+      !result.key.startsWith(m_currentDictName + QChar('\n')) ||
+      m_currentDict == nullptr || !m_currentDict->isLoaded())
+    return;
+
+  m_entryCache.insert(result.key, new RenderedEntry(result.entry),
+                      entryCost(result.entry));
+}
+
+void MainWindow::cancelPrefetch()
+{
+  m_prefetchWatcher.cancel();
+  m_prefetchWatcher.waitForFinished();
+
+  for (auto& future : m_stalePrefetches)
+    future.waitForFinished();
+
+  m_stalePrefetches.clear();
+}
+
+QString MainWindow::entryKey(const QString& word) const
+{
+  return m_currentDictName + QChar('\n') + word;
+}
+
+bool MainWindow::renderEntry(const QString& word)
+{
+  const QString key = entryKey(word);
+  RenderedEntry entry;
+
+  const RenderedEntry* cached = m_entryCache.object(key);
+  if (cached != nullptr) {
+    Stats::count(Stats::EntryCacheHits);
+    entry = *cached;
+  }
+  else {
+    Stats::count(Stats::EntryCacheMisses);
+
+    entry = prepareEntry(m_currentDict, m_imageCache, word);
+    if (entry.html.isNull())
+      return false;
+
+    // Only the headwords published so far are searched while loading
+    if (m_currentDict->isLoaded())
+      m_entryCache.insert(key, new RenderedEntry(entry), entryCost(entry));
+  }
+
+  ScopedTimer timer(Stats::Render);
+  m_html = entry.html;
+  m_ui->resultBrowser->setResourceMap(entry.resources);
+  m_ui->resultBrowser->setHtml(m_html);
+
+  return true;
+}
+
+bool MainWindow::showEntry(const QString& word, HistoryMode mode)
+{
+  // Results of all dictionaries arrive asynchronously
+  if (m_allDictionaries)
+    lookupAll(word);
+  else if (!renderEntry(word))
+    return false;
+
+  if (mode == NoHistory ||
+      (m_historyIndex >= 0 && m_history[m_historyIndex] == word))
+    return true;
+
+  // Replacing only touches the newest entry, and only if it was itself
+  // reached by browsing the list
+  if (mode == ReplaceHistory && m_historyTransient &&
+      m_historyIndex == m_history.size() - 1) {
+    m_history[m_historyIndex] = word;
+    return true;
+  }
+
+  while (m_history.size() > m_historyIndex + 1)
+    m_history.removeLast();
+
+  m_history.append(word);
+  if (m_history.size() > 100)
+    m_history.removeFirst();
+
+  m_historyIndex     = m_history.size() - 1;
+  m_historyTransient = mode == ReplaceHistory;
+  return true;
+}
+
+void MainWindow::cancelLookup()
+{
+  m_lookupWatcher.cancel();
+  m_lookupWatcher.waitForFinished();
+}
+
+void MainWindow::lookupAll(const QString& word)
+{
+  cancelLookup();
+
+  m_lookupWord = word;
+  m_html       = QString::null;
+  m_lookupResources.clear();
+
+  m_ui->resultBrowser->setResourceMap(m_lookupResources);
+  m_ui->resultBrowser->clear();
+
+  m_lookupWatcher.setFuture(m_dictionaries->lookup(word));
+}
+
+void MainWindow::lookupResultReady(int index)
+{
+  const DictLookup result = m_lookupWatcher.resultAt(index);
+  if (result.html.isNull())
+    return;
+
+  // Links and resources only make sense within their own dictionary, so
+  // qualify them with its position in the combo box
+  static const QRegularExpression qualify("\\b(href|src)=([\"']?)(?=\\d)");
+  const QString prefix =
+      QString::number(m_ui->dictComboBox->findText(result.dictionary)) + '/';
+
+  ImageCache* imageCache = m_dictionaries->imageCache(result.dictionary);
+  for (const auto& uid : result.resources) {
+    const QImage img = imageCache->image(uid.toUInt(nullptr, 10));
+    if (!img.isNull())
+      m_lookupResources[prefix + uid] = img;
+  }
+
+  QString html = result.html.mid(4);  // Without the leading <qt>
+  html.replace(qualify, "\\1=\\2" + prefix);
+
+  if (m_html.isEmpty())
+    m_html = "<qt>";
+
+  m_html += QString("<h3>%1</h3>%2<hr/>")
+                .arg(m_dictionaries->dictionary(result.dictionary)
+                         ->title()
+                         .toHtmlEscaped())
+                .arg(html);
+
+  ScopedTimer timer(Stats::Render);
+  m_ui->resultBrowser->setResourceMap(m_lookupResources);
+  m_ui->resultBrowser->setHtml(m_html);
+}
+
+void MainWindow::lookupFinished()
+{
+  if (m_lookupWatcher.isCanceled() || !m_html.isEmpty())
+    return;
+
+  // Do not keep words found nowhere in the history
+  if (m_historyIndex >= 0 && m_historyIndex == m_history.size() - 1 &&
+      m_history[m_historyIndex] == m_lookupWord) {
+    m_history.removeLast();
+    --m_historyIndex;
   }
 
-  m_ui->resultBrowser->setResourceMap(resourceMap);
+  showNotFound(m_lookupWord);
+}
+
+void MainWindow::goBack()
+{
+  if ((m_currentDict || m_allDictionaries) && m_historyIndex > 0)
+    showEntry(m_history[--m_historyIndex], NoHistory);
+}
+
+void MainWindow::goForward()
+{
+  if ((m_currentDict || m_allDictionaries) &&
+      m_historyIndex + 1 < m_history.size())
+    showEntry(m_history[++m_historyIndex], NoHistory);
 }
 
 void MainWindow::openLink(const QUrl& link)
 {
-  QString match = m_currentDict->resolveLink(link.toString());
+  QString match;
+
+  // Suggestions of the not found page
+  if (link.scheme() == "word") {
+    if (!showEntry(link.path(), PushHistory))
+      showNotFound(link.path());
+    return;
+  }
+
+  if (m_allDictionaries) {
+    // Qualified as <dictionary index>/<position>, see lookupResultReady()
+    const QString target = link.toString();
+    const int slash      = target.indexOf('/');
+    MobiDict* dict       = m_dictionaries->dictionary(
+        m_ui->dictComboBox->itemText(target.left(slash).toInt()));
+
+    if (slash > 0 && dict)
+      match = dict->resolveLink(target.mid(slash + 1));
+  }
+  else
+    match = m_currentDict->resolveLink(link.toString());
 
   // TODO: Have to provide feedback for broken links
-  if (!match.isEmpty()) {
-    m_html = m_currentDict->lookupWord(match);
-    createResources(m_html);
-    m_ui->resultBrowser->setHtml(m_html);
+  if (!match.isEmpty())
+    showEntry(match, PushHistory);
+}
+
+void MainWindow::setFullTextSearch(bool enabled)
+{
+  m_fullTextSearch = enabled;
+  m_lastPrefix     = QString::null;
+
+  if (enabled)
+    startTextIndexing();
+  else {
+    m_textIndexTimer.stop();
+    m_ui->searchLine->setPlaceholderText("Type a word to look up");
   }
+
+  if ((m_currentDict || m_allDictionaries) && m_ui->searchLine->isEnabled())
+    loadMatches(m_ui->searchLine->text());
+}
+
+void MainWindow::startTextIndexing()
+{
+  m_dictionaries->buildTextIndexes();
+
+  if (m_dictionaries->textIndexesReady()) {
+    m_ui->searchLine->setPlaceholderText("Search in definitions");
+    return;
+  }
+
+  m_ui->searchLine->setPlaceholderText("Indexing definitions...");
+  m_textIndexTimer.start();
+}
+
+void MainWindow::checkTextIndexes()
+{
+  if (!m_fullTextSearch || !m_dictionaries->textIndexesReady())
+    return;
+
+  m_textIndexTimer.stop();
+  m_ui->searchLine->setPlaceholderText("Search in definitions");
+
+  // Queries typed while indexing found nothing
+  if ((m_currentDict || m_allDictionaries) && m_ui->searchLine->isEnabled())
+    loadMatches(m_ui->searchLine->text());
 }
 
 void MainWindow::showSettingsDialog()
@@ -389,6 +1239,16 @@ void MainWindow::showSettingsDialog()
   QString fontName =
       m_settings->value("viewer/fontName", "Consolas").toString();
   int fontSize = m_settings->value("viewer/fontSize", 18).toInt();
+  bool regexSearch = m_settings->value("viewer/regexSearch", false).toBool();
+
+  if (regexSearch != m_regexSearch) {
+    m_regexSearch = regexSearch;
+    m_lastPrefix  = QString::null;
+
+    if ((m_currentDict || m_allDictionaries) &&
+        m_ui->searchLine->isEnabled())
+      loadMatches(m_ui->searchLine->text());
+  }
 
   if (fontName != m_fontName || fontSize != m_fontSize) {
     m_fontName = fontName;
@@ -403,6 +1263,12 @@ void MainWindow::showSettingsDialog()
   }
 }
 
+void MainWindow::showStatsDialog()
+{
+  m_statsDialog->show();
+  m_statsDialog->raise();
+}
+
 void MainWindow::copyWordToClipboard(const QModelIndex& index)
 {
   QApplication::clipboard()->setText(index.data().toString());
@@ -413,6 +1279,8 @@ void MainWindow::selfTest()
 {
   m_stopTesting = false;
 
+  // Let the matches of the dictionary come in
+  m_matchWatcher.waitForFinished();
   QApplication::processEvents();
   for (int i = 0; i < m_ui->matchesView->model()->rowCount(); ++i) {
     if (m_stopTesting)
@@ -1,15 +1,42 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+#include <QCache>
+#include <QElapsedTimer>
 #include <QFutureWatcher>
 #include <QSettings>
-#include <QStringListModel>
+#include <QTimer>
 #include <QWidget>
 
+#include "dictionarymanager.h"
+#include "imagecache.h"
+#include "matchesmodel.h"
 #include "mobidict.h"
 #include "ui_mainwindow.h"
 
 class Settings;
+class StatsDialog;
+
+typedef struct {
+  QString html;
+  QHash<QString, QImage> resources;
+} RenderedEntry;
+
+// An entry rendered ahead of time, keyed like the entry cache
+typedef struct {
+  QString key;
+  RenderedEntry entry;
+} PrefetchedEntry;
+
+// Part of the matches of one search, tagged with the search it belongs to.
+// Matches are headword ranks within one loaded dictionary, words otherwise.
+// Words merged from several dictionaries replace the ones shown so far.
+typedef struct {
+  quint64 generation;
+  QVector<int> ranks;
+  QStringList words;
+  bool replace;
+} MatchChunk;
 
 class MainWindow : public QWidget {
   Q_OBJECT
@@ -25,12 +52,26 @@ class MainWindow : public QWidget {
 
  public slots:
   void dictionaryLoaded();
+  void loadingStageChanged(int stage);
+  void wordsPublished(int count);
   void loadDictionary(const QString&);
   void openLink(const QUrl& link);
   void showSettingsDialog();
+  void showStatsDialog();
   void copyWordToClipboard(const QModelIndex&);
   void clearAndFocus();
   void handleSelectionChanged(const QItemSelection&);
+  void browseEntry();
+  void goBack();
+  void goForward();
+  void lookupResultReady(int);
+  void lookupFinished();
+  void setFullTextSearch(bool);
+  void checkTextIndexes();
+  void scheduleMatches();
+  void matchesReady(int);
+  void matchesFinished();
+  void prefetchReady(int);
 
  protected:
   bool eventFilter(QObject* obj, QEvent* ev) override;
@@ -40,22 +81,82 @@ class MainWindow : public QWidget {
  private:
   Ui::MainWindow* m_ui;
 
+  DictionaryManager* m_dictionaries;
   MobiDict* m_currentDict;
+  ImageCache* m_imageCache;
+  MobiDict* m_loadingDict;
+  ImageCache* m_loadingImages;
+  QString m_loadingName;
+  int m_publishedWords;
+  QStringList m_pendingLoads;
+  bool m_allDictionaries;
   QString m_currentDictName;
   QString m_deviceSerial;
   QString m_emojiFont;
   QString m_html;
   QString m_fontName;
   int m_fontSize;
-  QStringListModel* m_model;
+  bool m_regexSearch;
+  bool m_fullTextSearch;
+  QTimer m_textIndexTimer;
+  QString m_lastPrefix;
+  PrefixIndex::Range m_lastRange;
+  MatchesModel* m_model;
 
   QFutureWatcher<MOBI_RET> m_watcher;
   QFuture<MOBI_RET> m_future;
+  QFutureWatcher<DictLookup> m_lookupWatcher;
+  QString m_lookupWord;
+  QHash<QString, QImage> m_lookupResources;
+
+  // Matches are computed in the background, results of outdated searches
+  // are dropped by their generation
+  QFutureWatcher<MatchChunk> m_matchWatcher;
+  QList<QFuture<MatchChunk>> m_staleMatches;
+  QTimer m_matchTimer;
+  QElapsedTimer m_matchClock;
+  quint64 m_matchGeneration;
+  qint64 m_matchCost;
+  bool m_matchesShown;
+  bool m_selectFirstMatch;
+
+  // Neighbours of the selected match are rendered ahead of time
+  QFutureWatcher<PrefetchedEntry> m_prefetchWatcher;
+  QList<QFuture<PrefetchedEntry>> m_stalePrefetches;
+  QTimer m_browseTimer;
+  QString m_browseWord;
+  int m_browseRow;
+  int m_browseDirection;
 
   Settings* m_settingsDialog;
+  StatsDialog* m_statsDialog;
   QSettings* m_settings;
 
-  void createResources(const QString&);
+  enum HistoryMode { PushHistory, ReplaceHistory, NoHistory };
+
+  void startLoading();
+  void showLoadingDictionary();
+  bool isLoadWanted() const;
+  void dictionariesReady();
+  void cancelLookup();
+  void lookupAll(const QString&);
+  void showNotFound(const QString&);
+  void startTextIndexing();
+  void cancelMatches();
+  void setMatches(const MatchChunk&);
+  void selectFirstMatch();
+
+  void prefetch(int row, int direction);
+  void cancelPrefetch();
+
+  QString entryKey(const QString&) const;
+  bool renderEntry(const QString&);
+  bool showEntry(const QString&, HistoryMode);
+
+  QCache<QString, RenderedEntry> m_entryCache;
+  QStringList m_history;
+  int m_historyIndex;
+  bool m_historyTransient;
 
 #ifdef AUTOTEST
   void selfTest();
@@ -0,0 +1,198 @@
+#include <numeric>
+
+#include "matchesmodel.h"
+#include "mobidict.h"
+
+// Beyond this many changed runs of rows a reset is cheaper for the view
+static const int kMaxDeltaRuns = 64;
+
+namespace {
+
+typedef struct {
+  int row;
+  int count;
+} Run;
+
+void addRow(QVector<Run>* runs, int row)
+{
+  if (!runs->isEmpty() && runs->last().row + runs->last().count == row)
+    ++runs->last().count;
+  else
+    runs->append({row, 1});
+}
+
+}  // namespace
+
+MatchesModel::MatchesModel(QObject* parent) : QAbstractListModel(parent)
+{
+  m_dict = nullptr;
+  m_all  = false;
+}
+
+void MatchesModel::setDictionary(const MobiDict* dict)
+{
+  beginResetModel();
+  m_dict = dict;
+  m_all  = false;
+  m_ranks.clear();
+  m_words.clear();
+  endResetModel();
+}
+
+void MatchesModel::showAll()
+{
+  updateRanks(QVector<int>(), true);
+}
+
+void MatchesModel::setRanks(const QVector<int>& ranks)
+{
+  updateRanks(ranks, false);
+}
+
+void MatchesModel::appendRanks(const QVector<int>& ranks)
+{
+  // Every headword is already there
+  if (ranks.isEmpty() || m_all)
+    return;
+
+  const int row = rowCount();
+  beginInsertRows(QModelIndex(), row, row + ranks.size() - 1);
+  m_ranks += ranks;
+  endInsertRows();
+}
+
+void MatchesModel::setWords(const QStringList& words)
+{
+  beginResetModel();
+  m_all = false;
+  m_ranks.clear();
+  m_words = words;
+  endResetModel();
+}
+
+void MatchesModel::appendWords(const QStringList& words)
+{
+  if (words.isEmpty())
+    return;
+
+  const int row = rowCount();
+  beginInsertRows(QModelIndex(), row, row + words.size() - 1);
+  m_words += words;
+  endInsertRows();
+}
+
+void MatchesModel::clear()
+{
+  if (m_words.isEmpty())
+    setRanks(QVector<int>());
+  else
+    setWords(QStringList());
+}
+
+int MatchesModel::rowCount(const QModelIndex& parent) const
+{
+  if (parent.isValid())
+    return 0;
+
+  if (m_all)
+    return m_dict->wordCount();
+
+  return m_ranks.size() + m_words.size();
+}
+
+QVariant MatchesModel::data(const QModelIndex& index, int role) const
+{
+  if (!index.isValid() || index.row() >= rowCount())
+    return QVariant();
+
+  if (role != Qt::DisplayRole && role != Qt::EditRole)
+    return QVariant();
+
+  if (!m_words.isEmpty())
+    return m_words[index.row()];
+
+  return m_dict->word(rankAt(index.row()));
+}
+
+int MatchesModel::rankAt(int row) const
+{
+  return m_all ? row : m_ranks[row];
+}
+
+void MatchesModel::updateRanks(const QVector<int>& ranks, bool all)
+{
+  if (all && m_dict == nullptr)
+    return;
+
+  // Words of several dictionaries have nothing in common with ranks
+  if (!m_words.isEmpty()) {
+    beginResetModel();
+    m_words.clear();
+    m_all   = all;
+    m_ranks = ranks;
+    endResetModel();
+    return;
+  }
+
+  const int oldCount = rowCount();
+  const int newCount = all ? m_dict->wordCount() : ranks.size();
+  const auto newRank = [&](int row) { return all ? row : ranks[row]; };
+
+  // Both lists are sorted, merge them into runs of rows only in the old list
+  // (in old rows) and only in the new one (in new rows)
+  QVector<Run> removed;
+  QVector<Run> inserted;
+  int i = 0;
+  int j = 0;
+
+  while ((i < oldCount || j < newCount) &&
+         removed.size() + inserted.size() <= kMaxDeltaRuns) {
+    if (j == newCount || (i < oldCount && rankAt(i) < newRank(j)))
+      addRow(&removed, i++);
+    else if (i == oldCount || newRank(j) < rankAt(i))
+      addRow(&inserted, j++);
+    else {
+      ++i;
+      ++j;
+    }
+  }
+
+  if (removed.size() + inserted.size() > kMaxDeltaRuns) {
+    beginResetModel();
+    m_all   = all;
+    m_ranks = ranks;
+    endResetModel();
+    return;
+  }
+
+  // Spell out every headword to remove some of them
+  if (m_all && !removed.isEmpty()) {
+    m_ranks.resize(oldCount);
+    std::iota(m_ranks.begin(), m_ranks.end(), 0);
+    m_all = false;
+  }
+
+  // From the back, so that the rows of earlier runs stay valid
+  for (int k = removed.size() - 1; k >= 0; --k) {
+    const Run& run = removed[k];
+
+    beginRemoveRows(QModelIndex(), run.row, run.row + run.count - 1);
+    m_ranks.remove(run.row, run.count);
+    endRemoveRows();
+  }
+
+  // Only the common rows are left, inserting in order puts every run at its
+  // final row
+  for (const Run& run : inserted) {
+    beginInsertRows(QModelIndex(), run.row, run.row + run.count - 1);
+    m_ranks.insert(run.row, run.count, 0);
+    for (int row = run.row; row < run.row + run.count; ++row)
+      m_ranks[row] = newRank(row);
+    endInsertRows();
+  }
+
+  if (all) {
+    m_all = true;
+    m_ranks.clear();
+  }
+}
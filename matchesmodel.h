@@ -0,0 +1,46 @@
+#ifndef MATCHESMODEL_H
+#define MATCHESMODEL_H
+
+#include <QAbstractListModel>
+#include <QStringList>
+#include <QVector>
+
+class MobiDict;
+
+// List model of the matches of a search, without copies of the headwords.
+//
+// Matches within one dictionary are its headword ranks, in collation order,
+// and rows are decoded from the dictionary on demand. Changing them emits row
+// insertions and removals for the difference only, so narrowing or widening a
+// search costs the view what changed, not the size of the dictionary. Lists
+// merged from several dictionaries are held as words and replace each other.
+class MatchesModel : public QAbstractListModel {
+ public:
+  explicit MatchesModel(QObject* parent = nullptr);
+
+  void setDictionary(const MobiDict*);
+
+  void showAll();
+  void setRanks(const QVector<int>& ranks);
+  void appendRanks(const QVector<int>& ranks);
+  void setWords(const QStringList& words);
+  void appendWords(const QStringList& words);
+  void clear();
+
+  int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+  QVariant data(const QModelIndex& index,
+                int role = Qt::DisplayRole) const override;
+
+ private:
+  int rankAt(int row) const;
+  void updateRanks(const QVector<int>& ranks, bool all);
+
+  const MobiDict* m_dict;
+
+  // Every headword, without spelling out the ranks
+  bool m_all;
+  QVector<int> m_ranks;
+  QStringList m_words;
+};
+
+#endif
@@ -0,0 +1,595 @@
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QProcess>
+#include <QRegularExpression>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QThreadPool>
+#include <QtTest>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "dictgenerator.h"
+#include "fuzzyindex.h"
+#include "imagecache.h"
+#include "indexcache.h"
+#include "matchesmodel.h"
+#include "mobidict.h"
+
+// Benchmarks the dictionary hot paths against a generated dictionary.
+//
+// The dictionary shape is read from the environment so that the same binary
+// can be run against small and large dictionaries:
+//
+//   MOBIDICT_BENCH_WORDS    headword count (default 100000)
+//   MOBIDICT_BENCH_ENTRIES  entries per headword (default 1.2)
+//   MOBIDICT_BENCH_LINKS    filepos links per entry (default 0.5)
+//   MOBIDICT_BENCH_IMAGES   image records (default 200)
+//   MOBIDICT_BENCH_SEED     generator seed (default 1)
+//
+// Suggestions are searched among headwords generated on their own:
+//
+//   MOBIDICT_BENCH_FUZZY_WORDS  headword count (default 500000)
+//
+// Besides the QBENCHMARK results, latency percentiles and the peak resident
+// set size are printed for each test.
+
+namespace {
+
+const int kSamples = 2000;
+
+// Milliseconds to wait for the server to start and answer
+const int kServerTimeout = 60000;
+
+// Rows a match list shows without scrolling
+const int kVisibleRows = 40;
+
+double envNumber(const char *name, double defaultValue)
+{
+  bool ok;
+  const double value = qEnvironmentVariable(name).toDouble(&ok);
+  return ok ? value : defaultValue;
+}
+
+quint64 peakRss()
+{
+#ifdef Q_OS_WIN
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return counters.PeakWorkingSetSize;
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#ifdef Q_OS_MACOS
+  return usage.ru_maxrss;
+#else
+  return quint64(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// Records nanosecond samples and prints their distribution
+class Latency {
+ public:
+  explicit Latency(const QString &name) : m_name(name)
+  {
+    m_samples.reserve(kSamples);
+  }
+
+  void add(qint64 ns)
+  {
+    m_samples.push_back(ns);
+  }
+
+  void report()
+  {
+    if (m_samples.empty())
+      return;
+
+    std::sort(m_samples.begin(), m_samples.end());
+    qInfo("%-24s n=%-6d p50=%8.1fus p90=%8.1fus p99=%8.1fus max=%8.1fus",
+          qPrintable(m_name), int(m_samples.size()), percentile(0.50),
+          percentile(0.90), percentile(0.99), m_samples.back() / 1000.0);
+  }
+
+ private:
+  double percentile(double p) const
+  {
+    const size_t i = std::min(m_samples.size() - 1,
+                              size_t(p * (m_samples.size() - 1) + 0.5));
+    return m_samples[i] / 1000.0;
+  }
+
+  QString m_name;
+  std::vector<qint64> m_samples;
+};
+
+}  // namespace
+
+class Bench : public QObject {
+  Q_OBJECT
+
+ private slots:
+  void initTestCase();
+  void cleanup();
+  void cleanupTestCase();
+
+  void coldOpen();
+  void warmOpen();
+  void lookupWord();
+  void lookupMissing();
+  void compressedOpen();
+  void compressedLookup();
+  void resolveLink();
+  void allWords();
+  void prefixMatches();
+  void matchList();
+  void regexMatches();
+  void fuzzySuggestions();
+  void imageDecode();
+  void serverRoundTrip();
+
+ private:
+  QStringList sampleWords(int count);
+
+  QTemporaryDir m_dir;
+  QString m_path;
+  QString m_compressedPath;
+  int m_imageCount;
+  DictGenerator m_generator;
+  std::unique_ptr<MobiDict> m_dict;
+  std::unique_ptr<MobiDict> m_compressedDict;
+};
+
+void Bench::initTestCase()
+{
+  QVERIFY(m_dir.isValid());
+  m_path = m_dir.filePath("bench.mobi");
+
+  m_generator.setHeadwords(envNumber("MOBIDICT_BENCH_WORDS", 100000));
+  m_generator.setEntriesPerWord(envNumber("MOBIDICT_BENCH_ENTRIES", 1.2));
+  m_generator.setLinkDensity(envNumber("MOBIDICT_BENCH_LINKS", 0.5));
+  m_imageCount = envNumber("MOBIDICT_BENCH_IMAGES", 200);
+  m_generator.setImageCount(m_imageCount);
+  m_generator.setSeed(envNumber("MOBIDICT_BENCH_SEED", 1));
+
+  QElapsedTimer timer;
+  timer.start();
+  QVERIFY(m_generator.write(m_path));
+
+  qInfo("Generated %d headwords, %d entries, %lld bytes in %lld ms",
+        m_generator.words().size(), m_generator.entryOffsets().size(),
+        QFileInfo(m_path).size(), timer.elapsed());
+
+  // The same dictionary with PalmDOC compressed text records
+  DictGenerator compressed = m_generator;
+  compressed.setCompressed(true);
+  m_compressedPath = m_dir.filePath("compressed.mobi");
+  QVERIFY(compressed.write(m_compressedPath));
+
+  qInfo("Compressed to %lld bytes", QFileInfo(m_compressedPath).size());
+
+  m_dict.reset(new MobiDict(m_path, QString::null));
+  QCOMPARE(m_dict->open(), MOBI_SUCCESS);
+  QVERIFY(m_dict->isMapped());
+  m_compressedDict.reset(new MobiDict(m_compressedPath, QString::null));
+  QCOMPARE(m_compressedDict->open(), MOBI_SUCCESS);
+  QVERIFY(m_compressedDict->isMapped());
+  QThreadPool::globalInstance()->waitForDone();
+}
+
+void Bench::cleanup()
+{
+  qInfo("Peak RSS %.1f MiB", peakRss() / 1048576.0);
+}
+
+void Bench::cleanupTestCase()
+{
+  m_dict.reset();
+  m_compressedDict.reset();
+  QFile::remove(IndexCache(m_path, QString::null).fileName());
+  QFile::remove(IndexCache(m_compressedPath, QString::null).fileName());
+}
+
+void Bench::coldOpen()
+{
+  const QString cacheFile = IndexCache(m_path, QString::null).fileName();
+
+  QBENCHMARK {
+    QFile::remove(cacheFile);
+    MobiDict dict(m_path, QString::null);
+    QCOMPARE(dict.open(), MOBI_SUCCESS);
+    QThreadPool::globalInstance()->waitForDone();
+  }
+}
+
+void Bench::warmOpen()
+{
+  QVERIFY(QFile::exists(IndexCache(m_path, QString::null).fileName()));
+
+  QBENCHMARK {
+    MobiDict dict(m_path, QString::null);
+    QCOMPARE(dict.open(), MOBI_SUCCESS);
+    QVERIFY(dict.isMapped());
+  }
+}
+
+void Bench::lookupWord()
+{
+  const QStringList words = sampleWords(kSamples);
+  Latency latency("lookupWord");
+  QElapsedTimer timer;
+
+  for (const auto &word : words) {
+    timer.start();
+    const QString html = m_dict->lookupWord(word);
+    latency.add(timer.nsecsElapsed());
+    QVERIFY(!html.isNull());
+  }
+
+  latency.report();
+
+  int i = 0;
+  QBENCHMARK {
+    m_dict->lookupWord(words[i++ % words.size()]);
+  }
+}
+
+void Bench::lookupMissing()
+{
+  QBENCHMARK {
+    QVERIFY(m_dict->lookupWord("zzzzzzzz").isNull());
+  }
+}
+
+void Bench::compressedOpen()
+{
+  const QString cacheFile =
+      IndexCache(m_compressedPath, QString::null).fileName();
+
+  QBENCHMARK {
+    QFile::remove(cacheFile);
+    MobiDict dict(m_compressedPath, QString::null);
+    QCOMPARE(dict.open(), MOBI_SUCCESS);
+    QThreadPool::globalInstance()->waitForDone();
+  }
+}
+
+void Bench::compressedLookup()
+{
+  const QStringList words = sampleWords(kSamples);
+  Latency latency("compressed lookupWord");
+  QElapsedTimer timer;
+
+  for (const auto &word : words) {
+    timer.start();
+    const QString html = m_compressedDict->lookupWord(word);
+    latency.add(timer.nsecsElapsed());
+    QCOMPARE(html, m_dict->lookupWord(word));
+  }
+
+  latency.report();
+
+  int i = 0;
+  QBENCHMARK {
+    m_compressedDict->lookupWord(words[i++ % words.size()]);
+  }
+}
+
+void Bench::resolveLink()
+{
+  const QList<quint32> &offsets = m_generator.entryOffsets();
+  std::mt19937 rng(1);
+
+  QStringList links;
+  for (int i = 0; i < kSamples; ++i)
+    links.append(QString::number(offsets[rng() % offsets.size()]));
+
+  Latency latency("resolveLink");
+  QElapsedTimer timer;
+
+  for (const auto &link : links) {
+    timer.start();
+    const QString word = m_dict->resolveLink(link);
+    latency.add(timer.nsecsElapsed());
+    QVERIFY(!word.isEmpty());
+  }
+
+  latency.report();
+
+  int i = 0;
+  QBENCHMARK {
+    m_dict->resolveLink(links[i++ % links.size()]);
+  }
+}
+
+void Bench::allWords()
+{
+  QBENCHMARK {
+    QStringList matches;
+    matches.reserve(m_dict->wordCount());
+    for (int rank = 0; rank < m_dict->wordCount(); ++rank)
+      matches.append(m_dict->word(rank));
+  }
+}
+
+void Bench::prefixMatches()
+{
+  // Replays typing each sample word, narrowing the previous range the way
+  // MainWindow::loadMatches does
+  const PrefixIndex &index = m_dict->prefixIndex();
+  const QStringList words  = sampleWords(kSamples / 10);
+
+  Latency first("prefix 1st key");
+  Latency next("prefix next keys");
+  QElapsedTimer timer;
+
+  for (const auto &word : words) {
+    PrefixIndex::Range range;
+
+    for (int length = 1; length <= word.size(); ++length) {
+      const QString prefix = PrefixIndex::fold(word.left(length));
+
+      timer.start();
+      range = length == 1 ? index.find(prefix) : index.find(prefix, range);
+      const QVector<int> matches = index.ranks(range);
+      const qint64 elapsed       = timer.nsecsElapsed();
+
+      QVERIFY(!matches.isEmpty());
+      (length == 1 ? first : next).add(elapsed);
+    }
+  }
+
+  first.report();
+  next.report();
+
+  QBENCHMARK {
+    const QVector<int> matches =
+        index.ranks(index.find(PrefixIndex::fold("ka")));
+    Q_UNUSED(matches);
+  }
+}
+
+void Bench::matchList()
+{
+  // Replays typing each sample word into the match list, the way
+  // MainWindow::loadMatches updates its model, and reads the rows a view
+  // would paint
+  const PrefixIndex &index = m_dict->prefixIndex();
+  const QStringList words  = sampleWords(kSamples / 10);
+
+  MatchesModel model;
+  model.setDictionary(m_dict.get());
+
+  const auto paint = [&model]() {
+    const int rows = qMin(kVisibleRows, model.rowCount());
+    for (int row = 0; row < rows; ++row)
+      model.data(model.index(row, 0));
+  };
+
+  Latency latency("match list keys");
+  QElapsedTimer timer;
+
+  for (const auto &word : words) {
+    model.showAll();
+    PrefixIndex::Range range;
+
+    for (int length = 1; length <= word.size(); ++length) {
+      const QString prefix = PrefixIndex::fold(word.left(length));
+
+      timer.start();
+      range = length == 1 ? index.find(prefix) : index.find(prefix, range);
+      model.setRanks(index.ranks(range));
+      paint();
+      latency.add(timer.nsecsElapsed());
+
+      QVERIFY(model.rowCount() > 0);
+    }
+  }
+
+  latency.report();
+
+  // Widening back to every headword, then narrowing again
+  const QVector<int> ranks = index.ranks(index.find(PrefixIndex::fold("ka")));
+
+  QBENCHMARK {
+    model.showAll();
+    paint();
+    model.setRanks(ranks);
+    paint();
+  }
+}
+
+void Bench::regexMatches()
+{
+  const QRegularExpression regex("^ka.*shi$",
+                                 QRegularExpression::CaseInsensitiveOption);
+
+  QBENCHMARK {
+    QStringList matches;
+    for (int rank = 0; rank < m_dict->wordCount(); ++rank) {
+      const QString word = m_dict->word(rank);
+      if (regex.match(word).hasMatch())
+        matches.append(word);
+    }
+  }
+}
+
+void Bench::fuzzySuggestions()
+{
+  DictGenerator generator;
+  generator.setHeadwords(envNumber("MOBIDICT_BENCH_FUZZY_WORDS", 500000));
+  generator.setSeed(envNumber("MOBIDICT_BENCH_SEED", 1));
+  generator.generateWords();
+
+  const QStringList &words = generator.words();
+
+  // Ranks do not matter here, only that every word has one
+  WordStore store;
+  store.build(words, QVector<MobiEntry>(words.size()), QCollator());
+
+  PrefixIndex keys;
+  keys.build(store);
+
+  QElapsedTimer timer;
+  timer.start();
+
+  FuzzyIndex index;
+  index.build(keys);
+  qInfo("Built the fuzzy index of %d headwords in %lld ms", words.size(),
+        timer.elapsed());
+
+  // Typos: one character of a headword replaced
+  std::mt19937 rng(1);
+  QStringList typos;
+  for (int i = 0; i < kSamples / 10; ++i) {
+    QString word = PrefixIndex::fold(words[rng() % words.size()]);
+    word[int(rng() % word.size())] = QChar('a' + rng() % 26);
+    typos.append(word);
+  }
+
+  Latency latency("suggestions");
+
+  for (const auto &typo : typos) {
+    timer.start();
+    const QVector<int> ranks = index.find(typo, 2, 10);
+    latency.add(timer.nsecsElapsed());
+    QVERIFY(!ranks.isEmpty());
+  }
+
+  latency.report();
+
+  int i = 0;
+  QBENCHMARK {
+    index.find(typos[i++ % typos.size()], 2, 10);
+  }
+}
+
+void Bench::imageDecode()
+{
+  if (m_imageCount == 0)
+    QSKIP("No images");
+
+  ImageCache cache(m_dict.get(), 0);
+  Latency latency("image decode");
+  QElapsedTimer timer;
+
+  for (int uid = 0; uid < m_imageCount; ++uid) {
+    timer.start();
+    const QImage image = cache.image(uid);
+    latency.add(timer.nsecsElapsed());
+    QVERIFY(!image.isNull());
+  }
+
+  latency.report();
+}
+
+void Bench::serverRoundTrip()
+{
+  // Built next to the benchmark
+  const QString program = QStandardPaths::findExecutable(
+      "mobidict-server", {QCoreApplication::applicationDirPath()});
+  if (program.isEmpty())
+    QSKIP("No mobidict-server next to the benchmark");
+
+  const QString name =
+      QString("mobidict-bench-%1").arg(QCoreApplication::applicationPid());
+
+  QProcess server;
+  server.setReadChannel(QProcess::StandardError);
+  server.start(program, {"--name", name, m_path});
+
+  QByteArray banner;
+  while (!banner.contains("Serving")) {
+    QVERIFY2(server.waitForReadyRead(kServerTimeout), banner.constData());
+    banner += server.readAll();
+  }
+
+  QLocalSocket socket;
+  socket.connectToServer(name);
+  QVERIFY(socket.waitForConnected(kServerTimeout));
+
+  const auto request = [](int id, const QString &word) {
+    QJsonObject object;
+    object["id"]   = id;
+    object["op"]   = "lookup";
+    object["word"] = word;
+    return QJsonDocument(object).toJson(QJsonDocument::Compact) + '\n';
+  };
+
+  const auto response = [&socket]() {
+    while (!socket.canReadLine()) {
+      if (!socket.waitForReadyRead(kServerTimeout))
+        return QJsonObject();
+    }
+
+    return QJsonDocument::fromJson(socket.readLine()).object();
+  };
+
+  const QStringList words = sampleWords(kSamples);
+  Latency latency("server round trip");
+  QElapsedTimer timer;
+
+  for (int i = 0; i < words.size() / 10; ++i) {
+    timer.start();
+    socket.write(request(i, words[i]));
+    const QJsonObject answer = response();
+    latency.add(timer.nsecsElapsed());
+
+    QCOMPARE(answer["id"].toInt(), i);
+    QVERIFY(answer["found"].toBool());
+  }
+
+  latency.report();
+
+  // Pipelined, answered in batches and in order
+  timer.start();
+  for (int i = 0; i < words.size(); ++i)
+    socket.write(request(i, words[i]));
+
+  for (int i = 0; i < words.size(); ++i) {
+    const QJsonObject answer = response();
+    QCOMPARE(answer["id"].toInt(), i);
+    QVERIFY(answer["found"].toBool());
+  }
+
+  qInfo("%d pipelined lookups in %lld ms", words.size(), timer.elapsed());
+
+  socket.disconnectFromServer();
+  server.kill();
+  server.waitForFinished();
+  QLocalServer::removeServer(name);
+}
+
+QStringList Bench::sampleWords(int count)
+{
+  const QStringList &words = m_generator.words();
+  std::mt19937 rng(count);
+
+  QStringList sample;
+  for (int i = 0; i < count; ++i)
+    sample.append(words[rng() % words.size()]);
+
+  return sample;
+}
+
+QTEST_GUILESS_MAIN(Bench)
+
+#include "mobidict-bench.moc"
@@ -0,0 +1,171 @@
+#include <QtConcurrent/qtconcurrentmap.h>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QThreadPool>
+
+#include <cstdio>
+#include <functional>
+
+#include "mobidict.h"
+
+// Lines of a file are looked up in batches so output can be streamed in input
+// order. Lines of a pipe or terminal are answered as they come instead.
+static const int kBatchSize = 4096;
+
+enum OutputFormat { Html, Text, Json };
+
+static QByteArray formatResult(const MobiDict &dict, const QString &word,
+                               OutputFormat format)
+{
+  const QString html = dict.lookupWord(word);
+
+  if (format == Json) {
+    QJsonObject object;
+    object["word"]  = word;
+    object["found"] = !html.isNull();
+
+    if (!html.isNull()) {
+      object["html"] = html;
+      object["text"] = MobiDict::toPlainText(html);
+    }
+
+    return QJsonDocument(object).toJson(QJsonDocument::Compact) + '\n';
+  }
+
+  // One tab separated line per word, empty definition when not found
+  QString definition = format == Html ? html : MobiDict::toPlainText(html);
+  definition.replace('\n', ' ').replace('\t', ' ');
+
+  return (word + '\t' + definition).toUtf8() + '\n';
+}
+
+int main(int argc, char **argv)
+{
+  QCoreApplication::setOrganizationName("i10z");
+  QCoreApplication::setOrganizationDomain("i10z.com");
+  QCoreApplication::setApplicationName("mobidict");
+
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Looks up words read from a file or standard input, one per line.");
+  parser.addHelpOption();
+
+  QCommandLineOption formatOption(
+      {"f", "format"}, "Output format: html, text or json (default: text).",
+      "format", "text");
+  QCommandLineOption serialOption(
+      {"s", "serial"}, "E-reader serial number for dictionaries with DRM.",
+      "serial");
+  QCommandLineOption jobsOption(
+      {"j", "jobs"}, "Number of lookup threads (default: all cores).", "jobs");
+
+  parser.addOption(formatOption);
+  parser.addOption(serialOption);
+  parser.addOption(jobsOption);
+  parser.addPositionalArgument("dictionary", "Dictionary in azw/mobi format.");
+  parser.addPositionalArgument("words", "Word list, standard input if omitted.",
+                               "[words]");
+  parser.process(app);
+
+  const QStringList args = parser.positionalArguments();
+  if (args.isEmpty() || args.size() > 2)
+    parser.showHelp(1);
+
+  QTextStream err(stderr);
+
+  OutputFormat format;
+  const QString formatName = parser.value(formatOption);
+  if (formatName == "html")
+    format = Html;
+  else if (formatName == "text")
+    format = Text;
+  else if (formatName == "json")
+    format = Json;
+  else {
+    err << "Unknown output format " << formatName << '\n';
+    return 1;
+  }
+
+  if (parser.isSet(jobsOption)) {
+    const int jobs = parser.value(jobsOption).toInt();
+    if (jobs > 0)
+      QThreadPool::globalInstance()->setMaxThreadCount(jobs);
+  }
+
+  MobiDict dict(args[0], parser.value(serialOption));
+  const MOBI_RET result = dict.open();
+
+  if (result != MOBI_SUCCESS) {
+    err << "Error opening " << args[0] << ": " << libmobi_msg(result) << '\n';
+    return 1;
+  }
+
+  // The same input gives the same output, whether inflections were cached
+  dict.waitForInflections();
+
+  QFile input;
+  if (args.size() == 2) {
+    input.setFileName(args[1]);
+
+    if (!input.open(QIODevice::ReadOnly | QIODevice::Text)) {
+      err << "Failed to open " << args[1] << '\n';
+      return 1;
+    }
+  }
+  else {
+    // Unbuffered by stdio, a line is available as soon as it is written
+    input.open(fileno(stdin), QIODevice::ReadOnly | QIODevice::Text);
+  }
+
+  QTextStream in(&input);
+  in.setCodec("UTF-8");
+
+  const int batchSize = input.isSequential() ? 1 : kBatchSize;
+
+  QFile output;
+  output.open(stdout, QIODevice::WriteOnly);
+
+  std::function<QByteArray(const QString &)> lookup =
+      [&dict, format](const QString &word) {
+        return formatResult(dict, word, format);
+      };
+
+  QStringList batch;
+  batch.reserve(batchSize);
+  QString text;
+
+  for (;;) {
+    // Blocks until a line or the end of the input arrives, atEnd() would be
+    // true for pipes and terminals that have not written anything yet
+    const bool done = !in.readLineInto(&text);
+
+    if (!done) {
+      const QString word = text.trimmed();
+      if (!word.isEmpty())
+        batch.append(word);
+
+      if (batch.size() < batchSize)
+        continue;
+    }
+
+    const QList<QByteArray> lines =
+        QtConcurrent::blockingMapped<QList<QByteArray>>(batch, lookup);
+
+    for (const QByteArray &line : lines)
+      output.write(line);
+
+    output.flush();
+    batch.clear();
+
+    if (done)
+      break;
+  }
+
+  return 0;
+}
@@ -0,0 +1,362 @@
+#include <QtConcurrent/qtconcurrentmap.h>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QSet>
+#include <QTextStream>
+#include <QThreadPool>
+
+#include <functional>
+
+#include "mobidict.h"
+#include "stats.h"
+
+// Keeps dictionaries loaded and answers requests of local clients, one JSON
+// object per line, with one line each in the same order:
+//
+//   {"id": 1, "op": "lookup", "word": "house", "dict": "english.mobi"}
+//   {"id": 2, "op": "match", "word": "hou", "limit": 20}
+//   {"id": 3, "op": "resolve", "link": "123456"}
+//   {"id": 4, "op": "stats"}
+//
+// "dict" defaults to the first dictionary given. The lines a client sent
+// meanwhile are answered as one batch on the thread pool; dictionaries are
+// only read once loaded, so requests of every client run concurrently.
+
+// Lines answered at once, later ones wait for the next batch
+static const int kMaxBatch = 4096;
+
+// Matches returned when the request does not say
+static const int kDefaultMatchLimit = 100;
+
+// Milliseconds a server already listening on the name has to answer
+static const int kProbeTimeout = 1000;
+
+namespace {
+
+typedef struct {
+  QHash<QString, MobiDict*> byName;
+  QString defaultName;
+} Dictionaries;
+
+typedef struct {
+  QLocalSocket *socket;
+  QFutureWatcher<QByteArray> *watcher;
+  QByteArray buffer;
+  bool busy;
+  bool closed;
+} Connection;
+
+QJsonObject lookup(const MobiDict *dict, const QJsonObject &request)
+{
+  QStringList resources;
+  const QString html =
+      dict->lookupWord(request["word"].toString(), &resources);
+
+  QJsonObject response;
+  response["found"] = !html.isNull();
+
+  if (!html.isNull()) {
+    response["html"]      = html;
+    response["resources"] = QJsonArray::fromStringList(resources);
+
+    if (request["text"].toBool())
+      response["text"] = MobiDict::toPlainText(html);
+  }
+
+  return response;
+}
+
+QJsonObject match(const MobiDict *dict, const QJsonObject &request)
+{
+  const int limit = request["limit"].toInt(kDefaultMatchLimit);
+
+  const PrefixIndex &index = dict->prefixIndex();
+  const PrefixIndex::Range range =
+      index.find(PrefixIndex::fold(request["word"].toString()));
+
+  // The range is in folded key order, only the first matches in collation
+  // order are sorted
+  const QVector<int> ranks = index.ranks(range, limit);
+
+  QJsonObject response;
+  response["count"] = range.end - range.begin;
+  response["words"] = QJsonArray::fromStringList(dict->words(ranks));
+
+  return response;
+}
+
+QJsonObject resolve(const MobiDict *dict, const QJsonObject &request)
+{
+  const QString word = dict->resolveLink(request["link"].toString());
+
+  QJsonObject response;
+  response["found"] = !word.isNull();
+
+  if (!word.isNull())
+    response["word"] = word;
+
+  return response;
+}
+
+QByteArray handle(const Dictionaries &dictionaries, const QByteArray &line)
+{
+  QElapsedTimer timer;
+  timer.start();
+
+  QJsonParseError error;
+  const QJsonDocument document = QJsonDocument::fromJson(line, &error);
+  const QJsonObject request    = document.object();
+  const QString op             = request["op"].toString();
+
+  const MobiDict *dict = dictionaries.byName.value(
+      request["dict"].toString(dictionaries.defaultName));
+
+  QJsonObject response;
+
+  if (!document.isObject())
+    response["error"] = error.error == QJsonParseError::NoError
+                            ? "Request is not an object"
+                            : error.errorString();
+  else if (op == "stats")
+    response = Stats::toJson();
+  else if (dict == nullptr)
+    response["error"] = "Unknown dictionary";
+  else if (op == "lookup")
+    response = lookup(dict, request);
+  else if (op == "match")
+    response = match(dict, request);
+  else if (op == "resolve")
+    response = resolve(dict, request);
+  else
+    response["error"] = QString("Unknown operation %1").arg(op);
+
+  if (request.contains("id"))
+    response["id"] = request["id"];
+
+  const qint64 nsecs = timer.nsecsElapsed();
+  Stats::record(Stats::Serve, nsecs);
+  response["us"] = double(nsecs / 1000);
+
+  return QJsonDocument(response).toJson(QJsonDocument::Compact) + '\n';
+}
+
+void serve(Connection *connection,
+           const std::function<QByteArray(const QByteArray &)> &handler)
+{
+  // Answers go out in request order, one batch at a time
+  if (connection->closed || connection->busy)
+    return;
+
+  connection->buffer += connection->socket->readAll();
+
+  QList<QByteArray> lines;
+  int begin = 0;
+
+  while (lines.size() < kMaxBatch) {
+    const int end = connection->buffer.indexOf('\n', begin);
+    if (end < 0)
+      break;
+
+    const QByteArray line =
+        connection->buffer.mid(begin, end - begin).trimmed();
+    if (!line.isEmpty())
+      lines.append(line);
+
+    begin = end + 1;
+  }
+
+  connection->buffer.remove(0, begin);
+
+  if (lines.isEmpty())
+    return;
+
+  // Until its answers are written, not just until it is done
+  connection->busy = true;
+  connection->watcher->setFuture(QtConcurrent::mapped(lines, handler));
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+  QCoreApplication::setOrganizationName("i10z");
+  QCoreApplication::setOrganizationDomain("i10z.com");
+  QCoreApplication::setApplicationName("mobidict");
+
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Answers lookup, match and link requests of local clients.");
+  parser.addHelpOption();
+
+  QCommandLineOption nameOption(
+      {"n", "name"}, "Local socket name (default: mobidict).", "name",
+      "mobidict");
+  QCommandLineOption serialOption(
+      {"s", "serial"}, "E-reader serial number for dictionaries with DRM.",
+      "serial");
+  QCommandLineOption jobsOption(
+      {"j", "jobs"}, "Number of request threads (default: all cores).",
+      "jobs");
+
+  parser.addOption(nameOption);
+  parser.addOption(serialOption);
+  parser.addOption(jobsOption);
+  parser.addPositionalArgument("dictionaries",
+                               "Dictionaries in azw/mobi format.",
+                               "dictionaries...");
+  parser.process(app);
+
+  const QStringList args = parser.positionalArguments();
+  if (args.isEmpty())
+    parser.showHelp(1);
+
+  QTextStream err(stderr);
+
+  if (parser.isSet(jobsOption)) {
+    const int jobs = parser.value(jobsOption).toInt();
+    if (jobs > 0)
+      QThreadPool::globalInstance()->setMaxThreadCount(jobs);
+  }
+
+  // Requests name dictionaries by file name, which has to tell them apart
+  QSet<QString> names;
+  for (const auto &path : args) {
+    const QString name = QFileInfo(path).fileName();
+    if (names.contains(name)) {
+      err << "More than one dictionary named " << name << '\n';
+      return 1;
+    }
+
+    names.insert(name);
+  }
+
+  // Opened in parallel, then only read from
+  QList<MobiDict*> opened;
+  for (const auto &path : args)
+    opened.append(new MobiDict(path, parser.value(serialOption)));
+
+  std::function<MOBI_RET(MobiDict*)> open = [](MobiDict *dict) {
+    return dict->open();
+  };
+  const QList<MOBI_RET> results =
+      QtConcurrent::blockingMapped<QList<MOBI_RET>>(opened, open);
+
+  Dictionaries dictionaries;
+
+  for (int i = 0; i < opened.size(); ++i) {
+    if (results[i] != MOBI_SUCCESS) {
+      err << "Error opening " << args[i] << ": " << libmobi_msg(results[i])
+          << '\n';
+      qDeleteAll(opened);
+      return 1;
+    }
+
+    // Answers do not depend on whether inflections were cached
+    opened[i]->waitForInflections();
+
+    const QString name = QFileInfo(args[i]).fileName();
+    dictionaries.byName.insert(name, opened[i]);
+
+    if (i == 0)
+      dictionaries.defaultName = name;
+  }
+
+  std::function<QByteArray(const QByteArray &)> handler =
+      [&dictionaries](const QByteArray &line) {
+        return handle(dictionaries, line);
+      };
+
+  const QString name = parser.value(nameOption);
+
+  QLocalServer server;
+  server.setSocketOptions(QLocalServer::UserAccessOption);
+
+  // A stale socket of a server that did not exit cleanly would be in the way,
+  // one that still answers belongs to a running server and is left alone
+  bool listening = server.listen(name);
+
+  if (!listening &&
+      server.serverError() == QAbstractSocket::AddressInUseError) {
+    QLocalSocket probe;
+    probe.connectToServer(name);
+
+    if (!probe.waitForConnected(kProbeTimeout)) {
+      QLocalServer::removeServer(name);
+      listening = server.listen(name);
+    }
+  }
+
+  if (!listening) {
+    err << "Failed to listen on " << name << ": " << server.errorString()
+        << '\n';
+    qDeleteAll(opened);
+    return 1;
+  }
+
+  QObject::connect(&server, &QLocalServer::newConnection, [&server, handler]() {
+    while (server.hasPendingConnections()) {
+      Connection *connection = new Connection;
+      connection->socket     = server.nextPendingConnection();
+      connection->watcher    = new QFutureWatcher<QByteArray>;
+      connection->busy       = false;
+      connection->closed     = false;
+
+      QLocalSocket *socket = connection->socket;
+
+      QObject::connect(socket, &QLocalSocket::readyRead, socket,
+                       [connection, handler]() { serve(connection, handler); });
+
+      // Freed once the batch in flight is done
+      QObject::connect(
+          connection->watcher, &QFutureWatcher<QByteArray>::finished,
+          connection->watcher, [connection, handler]() {
+            connection->busy = false;
+
+            if (connection->closed) {
+              connection->watcher->deleteLater();
+              delete connection;
+              return;
+            }
+
+            for (const auto &response : connection->watcher->future().results())
+              connection->socket->write(response);
+
+            serve(connection, handler);
+          });
+
+      QObject::connect(
+          socket, &QLocalSocket::disconnected, socket, [connection]() {
+            connection->closed = true;
+            connection->socket->deleteLater();
+
+            if (!connection->busy) {
+              connection->watcher->deleteLater();
+              delete connection;
+            }
+          });
+    }
+  });
+
+  // Clients may wait for this line before connecting
+  err << "Serving " << dictionaries.byName.size() << " dictionaries on "
+      << server.fullServerName() << '\n';
+  err.flush();
+
+  const int result = app.exec();
+
+  QThreadPool::globalInstance()->waitForDone();
+  qDeleteAll(opened);
+
+  return result;
+}
@@ -1,88 +1,416 @@
+#include <QtConcurrent/qtconcurrentrun.h>
 #include <QCollator>
 #include <QDebug>
 #include <QElapsedTimer>
 
+#include <algorithm>
+#include <cstring>
+
+#include "indexcache.h"
 #include "mobidict.h"
+#include "stats.h"
+#include "textrecordreader.h"
+
+// Internal libmobi loaders and parsers, used to load the records from a file
+// mapping and to parse the ORTH index without reconstructing the text flow
+extern "C" {
+#include "index.h"
+#include "parse_rawml.h"
+#include "read.h"
+#include "util.h"
+}
+
+// Decompressed text records kept by the lazy reader
+static const int kTextRecordCacheSize = 256;
+
+// Headwords made searchable at a time while loading
+static const int kPublishChunk = 4096;
+
+namespace {
+
+typedef struct {
+  const char *from;
+  int length;
+  const char *to;
+  bool resource;
+} Rewrite;
+
+// Change filepos -> href, {hi,low}recindex -> src
+// so that Qt can give us a url in QTextBrowser::loadResource()
+const Rewrite kRewrites[] = {
+    {"filepos=", 8, "href=", false},    {"hirecindex=", 11, "src=", true},
+    {"lowrecindex=", 12, "src=", true}, {"recindex=", 9, "src=", true},
+    {"src=", 4, "src=", true},
+};
+
+// Resource uids are numeric, optionally quoted attribute values
+void collectResource(const char *p, const char *end, QStringList *resources)
+{
+  if (p < end && (*p == '"' || *p == '\''))
+    ++p;
+
+  const char *start = p;
+  while (p < end && *p >= '0' && *p <= '9')
+    ++p;
+
+  if (p == start)
+    return;
+
+  const QString uid = QString::fromLatin1(start, p - start);
+  if (!resources->contains(uid))
+    resources->append(uid);
+}
+
+// Copies one entry to out, rewriting the attributes above in a single pass.
+// Both UTF-8 and CP1252 are ASCII compatible so this works on the raw bytes.
+void rewriteEntry(const char *data, uint32_t length, QByteArray *out,
+                  QStringList *resources)
+{
+  const char *end  = data + length;
+  const char *copy = data;
+  const char *p    = data;
+
+  out->reserve(length);
+
+  while (p < end) {
+    const char c = *p;
+    if (c != 'f' && c != 'h' && c != 'l' && c != 'r' && c != 's') {
+      ++p;
+      continue;
+    }
+
+    const Rewrite *match = nullptr;
+    for (const Rewrite &rewrite : kRewrites) {
+      if (end - p >= rewrite.length &&
+          memcmp(p, rewrite.from, rewrite.length) == 0) {
+        match = &rewrite;
+        break;
+      }
+    }
+
+    if (match == nullptr) {
+      ++p;
+      continue;
+    }
+
+    out->append(copy, p - copy);
+    out->append(match->to);
+    p += match->length;
+    copy = p;
+
+    if (match->resource && resources != nullptr)
+      collectResource(p, end, resources);
+  }
+
+  out->append(copy, end - copy);
+}
+
+}  // namespace
 
 MobiDict::MobiDict(const QString &path, const QString &serial) : QObject()
 {
   m_codec        = nullptr;
   m_deviceSerial = serial;
+  m_indexCache   = nullptr;
+  m_inflCache    = nullptr;
   m_isCP1252     = false;
   m_language     = QString::null;
+  m_loaded       = false;
+  m_cancel       = false;
+  m_canceled     = false;
+  m_map          = nullptr;
   m_mobiData     = nullptr;
   m_rawMarkup    = nullptr;
+  m_textCache    = nullptr;
+  m_textReader   = nullptr;
   m_path         = path;
   m_title        = QString::null;
+
+  m_textIndexReady   = false;
+  m_inflectionsReady = false;
+  m_closing          = false;
 }
 
 MobiDict::~MobiDict()
 {
+  // Building the text index can take a while, have it give up
+  m_closing = true;
+  m_textFuture.waitForFinished();
+  m_fuzzyFuture.waitForFinished();
+  m_inflFuture.waitForFinished();
+
+  m_inflections.clear();
+  delete m_inflCache;
+
+  m_textIndex.clear();
+  delete m_textCache;
+  delete m_textReader;
+
+  // Mapped records are not libmobi's to free
+  detachRecords();
   mobi_free(m_mobiData);
   mobi_free_rawml(m_rawMarkup);
 
-  for (const auto &key : m_wordHash.keys())
-    qDeleteAll(m_wordHash[key]);
+  // The word store may point into the mapped index
+  m_store.clear();
+  delete m_indexCache;
 }
 
-QString MobiDict::resolveLink(const QString &link)
+QString MobiDict::resolveLink(const QString &link) const
 {
-  const uint32_t offset = link.toUInt();
-  QString match         = QString::null;
+  bool ok               = false;
+  const uint32_t offset = link.toUInt(&ok);
 
-  for (const auto &entry : m_wordHash.keys()) {
-    for (const auto &mobiEntry : m_wordHash[entry]) {
-      if (mobiEntry->startPos == offset) {
-        match = entry;
-        break;
-      }
-    }
+  if (!ok || !m_loaded || m_offsets.isEmpty())
+    return QString::null;
+
+  // First entry starting after the offset
+  auto it = std::upper_bound(
+      m_offsets.constBegin(), m_offsets.constEnd(), offset,
+      [](uint32_t pos, const MobiOffset &o) { return pos < o.startPos; });
+
+  // Prefer the entry containing the offset, otherwise the link points at
+  // markup between two entries and the following one is what is meant.
+  if (it != m_offsets.constBegin()) {
+    const MobiOffset &previous = *(it - 1);
+    if (offset - previous.startPos < previous.textLength)
+      return m_store.word(previous.rank);
   }
 
-  return match;
+  if (it != m_offsets.constEnd())
+    return m_store.word(it->rank);
+
+  return QString::null;
 }
 
-QString MobiDict::lookupWord(const QString &word)
+QString MobiDict::lookupWord(const QString &word,
+                             QStringList *resources) const
 {
-  if (m_wordHash.constFind(word) == m_wordHash.constEnd())
+  ScopedTimer timer(Stats::Lookup);
+
+  // Prefer an exact hit, otherwise take every headword with the same folded
+  // key, so that case, accents and normalization do not matter
+  QVector<int> ranks;
+  QVector<MobiEntry> entries;
+
+  if (!m_loaded)
+    entries = partialEntries(word);
+  else {
+    const int rank = m_store.find(word);
+
+    if (rank >= 0)
+      ranks.append(rank);
+    else
+      ranks = m_prefixIndex.ranks(
+          m_prefixIndex.findExact(PrefixIndex::fold(word)));
+
+    if (ranks.isEmpty()) {
+      for (const auto &headword : baseForms(word)) {
+        const int base = m_store.find(headword);
+        if (base >= 0 && !ranks.contains(base))
+          ranks.append(base);
+      }
+    }
+  }
+
+  for (int r : ranks) {
+    int count             = 0;
+    const MobiEntry *runs = m_store.entries(r, &count);
+
+    for (int i = 0; i < count; ++i)
+      entries.append(runs[i]);
+  }
+
+  if (entries.isEmpty())
     return QString::null;
 
+  int length = 0;
+  for (const auto &entry : entries)
+    length += entry.textLength;
+
   // Force rich-text detection
   QString result = "<qt>";
+  result.reserve(length + 4);
 
-  uint32_t entry_startpos = 0;
-  uint32_t entry_textlen  = 0;
+  QByteArray html;
+  QByteArray text;
+  bool hasText = false;
 
-  for (const auto &mobiEntry : m_wordHash[word]) {
-    const MobiEntry *const m = mobiEntry;
-    entry_startpos           = m->startPos;
-    entry_textlen            = m->textLength;
+  for (int i = 0; i < entries.size(); ++i) {
+    const char *data;
 
-    std::string html;
-    html.assign(m_rawMarkup->flow->data + entry_startpos,
-                m_rawMarkup->flow->data + entry_startpos + entry_textlen);
+    if (m_textReader != nullptr) {
+      text.clear();
+      if (!m_textReader->read(entries[i].startPos, entries[i].textLength,
+                              &text))
+        continue;
 
-    if (m_isCP1252)
-      result.append(m_codec->toUnicode(html.c_str()));
+      data = text.constData();
+    }
     else
-      result.append(QString::fromUtf8(html.c_str()));
+      data = m_rawMarkup->flow->data + entries[i].startPos;
 
-    // Change filepos -> href, {hi,low}recindex -> src
-    // so that Qt can give us a url in QTextBrowser::loadResource()
-    result = result.replace("filepos=", "href=");
-    result = result.replace("hirecindex=", "src=");
-    result = result.replace("lowrecindex=", "src=");
-    result = result.replace("recindex=", "src=");
+    ScopedTimer rewrite(Stats::RewriteHtml);
+    html.clear();
+    rewriteEntry(data, entries[i].textLength, &html, resources);
+    result.append(decode(html));
+    hasText = true;
 
     // qWarning() << "HTML entry:";
     // qWarning() << result;
   }
 
-  return result;
+  // Not found rather than an empty entry if no text could be read
+  return hasText ? result : QString::null;
+}
+
+QStringList MobiDict::baseForms(const QString &word) const
+{
+  // Decoded in the background on the first load
+  if (!m_inflectionsReady)
+    return QStringList();
+
+  return m_inflections.headwords(word);
+}
+
+QStringList MobiDict::suggestions(const QString &word, int limit) const
+{
+  // Still being built
+  if (!m_loaded || !m_fuzzyFuture.isFinished())
+    return QStringList();
+
+  // Allow one edit per four characters, between one and two
+  const QString folded  = PrefixIndex::fold(word);
+  const int maxDistance = qBound(1, folded.size() / 4, 2);
+
+  return words(m_fuzzyIndex.find(folded, maxDistance, limit));
+}
+
+void MobiDict::buildTextIndex()
+{
+  if (!m_loaded || m_textIndexReady || m_textFuture.isRunning())
+    return;
+
+  m_textFuture = QtConcurrent::run([this]() { loadTextIndex(); });
+}
+
+bool MobiDict::isTextIndexReady() const
+{
+  return m_textIndexReady;
+}
+
+QVector<int> MobiDict::searchText(const QString &query) const
+{
+  if (!m_textIndexReady)
+    return QVector<int>();
+
+  const QVector<quint32> ids =
+      m_textIndex.search(query, [this](int id) { return entryText(id); });
+
+  // Entries are numbered in text order, list their headwords in rank order
+  QVector<int> ranks;
+  ranks.reserve(ids.size());
+  for (quint32 id : ids)
+    ranks.append(m_offsets[id].rank);
+
+  std::sort(ranks.begin(), ranks.end());
+  ranks.erase(std::unique(ranks.begin(), ranks.end()), ranks.end());
+
+  return ranks;
+}
+
+QString MobiDict::toPlainText(const QString &html)
+{
+  static const QStringList blockTags = {
+      "blockquote", "br", "div", "h1", "h2", "h3", "h4",
+      "h5", "h6", "hr", "li", "p", "idx:entry", "tr"};
+
+  QString text;
+  text.reserve(html.size());
+
+  const int length = html.size();
+  int i            = 0;
+
+  while (i < length) {
+    const QChar c = html[i];
+
+    if (c == '<') {
+      int end = html.indexOf('>', i);
+      if (end < 0)
+        end = length;
+
+      // Tag name without the closing slash and attributes
+      int start = i + 1;
+      if (start < end && html[start] == '/')
+        ++start;
+
+      int nameEnd = start;
+      while (nameEnd < end && !html[nameEnd].isSpace() &&
+             html[nameEnd] != '/')
+        ++nameEnd;
+
+      const QString name = html.mid(start, nameEnd - start).toLower();
+      if (blockTags.contains(name) && !text.endsWith('\n'))
+        text.append('\n');
+
+      i = end + 1;
+      continue;
+    }
+
+    if (c == '&') {
+      const int end = html.indexOf(';', i);
+
+      if (end > i + 1 && end - i <= 10) {
+        const QString entity = html.mid(i + 1, end - i - 1);
+        QChar decoded;
+
+        if (entity == "amp")
+          decoded = '&';
+        else if (entity == "lt")
+          decoded = '<';
+        else if (entity == "gt")
+          decoded = '>';
+        else if (entity == "quot")
+          decoded = '"';
+        else if (entity == "apos")
+          decoded = '\'';
+        else if (entity == "nbsp")
+          decoded = ' ';
+        else if (entity.startsWith("#x") || entity.startsWith("#X"))
+          decoded = QChar(entity.mid(2).toUShort(nullptr, 16));
+        else if (entity.startsWith('#'))
+          decoded = QChar(entity.mid(1).toUShort(nullptr, 10));
+
+        if (!decoded.isNull()) {
+          text.append(decoded);
+          i = end + 1;
+          continue;
+        }
+      }
+    }
+
+    // Source line breaks are just whitespace in HTML
+    text.append(c.isSpace() ? QChar(' ') : c);
+    ++i;
+  }
+
+  // Collapse whitespace and drop empty lines
+  QStringList lines;
+  for (const auto &line : text.split('\n')) {
+    const QString simplified = line.simplified();
+    if (!simplified.isEmpty())
+      lines.append(simplified);
+  }
+
+  return lines.join('\n');
 }
 
 MOBI_RET MobiDict::open()
 {
+  ScopedTimer total(Stats::Load);
+  ScopedTimer phase(Stats::LoadRead);
+  emit stageChanged(ReadingFile);
+
   m_mobiData = mobi_init();
   if (m_mobiData == nullptr)
     return MOBI_MALLOC_FAILED;
@@ -109,9 +437,29 @@ MOBI_RET MobiDict::open()
   timer.start();
 #endif
 
-  MOBI_RET mobi_ret = mobi_load_file(m_mobiData, file);
+  MOBI_RET mobi_ret = loadMapped(file);
+  if (mobi_ret != MOBI_SUCCESS) {
+    // Read the whole file into memory instead
+    detachRecords();
+    mobi_free(m_mobiData);
+
+    m_mobiData = mobi_init();
+    if (m_mobiData == nullptr) {
+      fclose(file);
+      return MOBI_MALLOC_FAILED;
+    }
+
+    rewind(file);
+    mobi_ret = mobi_load_file(m_mobiData, file);
+  }
+
   fclose(file);
 
+  if (checkCanceled())
+    return MOBI_ERROR;
+
+  phase.next(Stats::LoadDrm);
+
   if (mobi_is_encrypted(m_mobiData)) {
     if (!m_deviceSerial.isEmpty()) {
       // qWarning() << "Using device serial" << m_deviceSerial;
@@ -137,18 +485,251 @@ MOBI_RET MobiDict::open()
   free(title);
   free(language);
 
+  phase.next(Stats::LoadRawml);
+  emit stageChanged(ParsingText);
+
   m_rawMarkup = mobi_init_rawml(m_mobiData);
   if (m_rawMarkup == nullptr)
     return MOBI_MALLOC_FAILED;
 
-  mobi_ret =
-      mobi_parse_rawml_opt(m_rawMarkup, m_mobiData, false, /* parse toc */
-                           true,                           /* parse dic */
-                           false /* reconstruct */);
+  // A valid index cache already holds every headword and their prefix index,
+  // so skip parsing the ORTH index and indexing its labels altogether.
+  // Inflections have a cache of their own and are decoded in the background
+  // when it is missing.
+  m_indexCache = new IndexCache(m_path, m_deviceSerial);
+  m_inflCache  = new IndexCache(m_path, m_deviceSerial, "infl");
+
+  const bool warmStart =
+      m_indexCache->open() && m_indexCache->imageCount() == 3 &&
+      m_store.attach(m_indexCache->imageData(0), m_indexCache->imageSize(0)) &&
+      m_prefixIndex.attach(m_indexCache->imageData(1),
+                           m_indexCache->imageSize(1)) &&
+      m_prefixIndex.count() == m_store.count() &&
+      m_indexCache->imageSize(2) == sizeof(quint32);
+
+  // It also keeps the layout of the text records, which takes decompressing
+  // all of them to find out. Reads still check the records they touch.
+  quint32 textLayout = TextRecordReader::Unchecked;
+  if (warmStart)
+    memcpy(&textLayout, m_indexCache->imageData(2), sizeof(textLayout));
+
+  if (textLayout > TextRecordReader::Sequential)
+    textLayout = TextRecordReader::Unchecked;
+
+  const bool hasInflections = mobi_exists_infl(m_mobiData);
+  m_inflectionsReady =
+      hasInflections && m_inflCache->open() && m_inflCache->imageCount() == 1 &&
+      m_inflections.attach(m_inflCache->imageData(), m_inflCache->imageSize());
+
+  // Entries are decompressed on demand when the text records allow it,
+  // otherwise the whole flow is reconstructed up front
+  m_textReader = new TextRecordReader(m_mobiData, kTextRecordCacheSize);
+
+  if (m_textReader->open(TextRecordReader::Layout(textLayout)) ==
+      MOBI_SUCCESS) {
+    mobi_ret   = MOBI_SUCCESS;
+    textLayout = m_textReader->layout();
+
+    // Offsets cannot be mapped into records of varying sizes, decompress them
+    // all up front, in parallel
+    if (!m_textReader->isRandomAccess()) {
+      m_rawMarkup->flow = m_textReader->readAll();
+      delete m_textReader;
+      m_textReader = nullptr;
+
+      if (m_rawMarkup->flow == nullptr)
+        mobi_ret = MOBI_DATA_CORRUPT;
+    }
+
+    if (mobi_ret == MOBI_SUCCESS && !warmStart)
+      mobi_ret = parseOrthIndex(&m_rawMarkup->orth, &m_rawMarkup->infl);
+
+    if (mobi_ret == MOBI_SUCCESS)
+      mobi_ret = mobi_reconstruct_resources(m_mobiData, m_rawMarkup);
+  }
+  else {
+    delete m_textReader;
+    m_textReader = nullptr;
+
+    mobi_ret =
+        mobi_parse_rawml_opt(m_rawMarkup, m_mobiData, false, /* parse toc */
+                             !warmStart,                     /* parse dic */
+                             false /* reconstruct */);
+  }
+
+  if (mobi_ret != MOBI_SUCCESS)
+    return mobi_ret;
+
+  if (checkCanceled())
+    return MOBI_ERROR;
+
+  phase.next(Stats::LoadIndex);
+
+  if (!warmStart) {
+    m_store.clear();
+    m_prefixIndex.clear();
+    m_indexCache->close();
+    emit stageChanged(ReadingHeadwords);
+
+    QStringList labels;
+    QVector<MobiEntry> entries;
+
+    mobi_ret = loadOrthIndex(&labels, &entries);
+    if (mobi_ret != MOBI_SUCCESS)
+      return mobi_ret;
+
+    // Sorting and indexing takes longer than reading, headwords can be
+    // searched in ORTH order meanwhile
+    emit stageChanged(IndexingHeadwords);
+    m_store.build(labels, entries, collator());
+
+    // Headwords are only kept by the store, indexes address them by rank
+    m_prefixIndex.build(m_store);
+
+    if (checkCanceled())
+      return MOBI_ERROR;
+
+    // Write the sidecar off the loading path, next start will pick it up
+    const QString fileName = m_indexCache->fileName();
+    const QByteArray layout(reinterpret_cast<const char *>(&textLayout),
+                            sizeof(textLayout));
+    const QByteArray data = m_indexCache->serialize(
+        {m_store.data(), m_prefixIndex.data(), layout});
+    QtConcurrent::run([fileName, data]() { IndexCache::save(fileName, data); });
+  }
+
+  if (hasInflections && !m_inflectionsReady) {
+    m_inflections.clear();
+    m_inflCache->close();
+    m_inflFuture = QtConcurrent::run([this]() { buildInflections(); });
+  }
+
+  if (m_store.count() == 0) {
+    qWarning() << "Failed to find any word.";
+    return MOBI_DATA_CORRUPT;
+  }
+
+  buildOffsetIndex();
+
+  // Suggestions are only needed on misses, do not hold up loading for them
+  m_fuzzyFuture =
+      QtConcurrent::run([this]() { m_fuzzyIndex.build(m_prefixIndex); });
+
+  m_loaded = true;
+
+  // Searches go through the complete index from now on
+  QMutexLocker locker(&m_partialMutex);
+  m_partialWords.clear();
+  m_partialKeys.clear();
+  m_partialEntries.clear();
+  locker.unlock();
+
+#ifndef NDEBUG
+  qDebug() << "Dictionary loaded in" << timer.elapsed() << "miliseconds"
+           << (warmStart ? "from index cache" : "");
+#endif
+
+  return MOBI_SUCCESS;
+}
+
+MOBI_RET MobiDict::loadMapped(FILE *file)
+{
+  m_file.setFileName(m_path);
+  if (!m_file.open(QIODevice::ReadOnly))
+    return MOBI_FILE_NOT_FOUND;
+
+  // A private mapping, libmobi does not expect its records to be read-only
+  const qint64 size = m_file.size();
+  m_map             = m_file.map(0, size, QFileDevice::MapPrivateOption);
+  if (m_map == nullptr)
+    return MOBI_MALLOC_FAILED;
+
+  // Only the PDB header and record list are read from the file
+  MOBI_RET mobi_ret = mobi_load_pdbheader(m_mobiData, file);
+  if (mobi_ret != MOBI_SUCCESS)
+    return mobi_ret;
 
+  if (strcmp(m_mobiData->ph->type, "BOOK") != 0 &&
+      strcmp(m_mobiData->ph->type, "TEXt") != 0)
+    return MOBI_FILE_UNSUPPORTED;
+
+  if (m_mobiData->ph->rec_count == 0)
+    return MOBI_DATA_CORRUPT;
+
+  mobi_ret = mobi_load_reclist(m_mobiData, file);
   if (mobi_ret != MOBI_SUCCESS)
     return mobi_ret;
 
+  // Sizes follow from the offsets, like mobi_load_rec() does
+  for (MOBIPdbRecord *r = m_mobiData->rec; r != nullptr; r = r->next) {
+    const qint64 end = r->next != nullptr ? qint64(r->next->offset) : size;
+    if (end < qint64(r->offset) || end > size)
+      return MOBI_DATA_CORRUPT;
+
+    // Empty records at the end would point past the mapping
+    r->size = size_t(end - r->offset);
+    r->data = r->size > 0 ? m_map + r->offset : nullptr;
+  }
+
+  mobi_ret = mobi_parse_record0(m_mobiData, 0);
+  if (mobi_ret != MOBI_SUCCESS)
+    return mobi_ret;
+
+  // Old PalmDOC encryption and KF8 hybrids need the rest of mobi_load_file()
+  if ((m_mobiData->rh && m_mobiData->rh->encryption_type == 1) ||
+      mobi_is_hybrid(m_mobiData))
+    return MOBI_FILE_UNSUPPORTED;
+
+  return MOBI_SUCCESS;
+}
+
+void MobiDict::detachRecords()
+{
+  if (m_map == nullptr)
+    return;
+
+  if (m_mobiData != nullptr) {
+    for (MOBIPdbRecord *r = m_mobiData->rec; r != nullptr; r = r->next) {
+      if (r->data >= m_map && r->data < m_map + m_file.size())
+        r->data = nullptr;
+    }
+  }
+
+  m_file.unmap(m_map);
+  m_file.close();
+  m_map = nullptr;
+}
+
+MOBI_RET MobiDict::parseOrthIndex(MOBIIndx **orth, MOBIIndx **infl) const
+{
+  if (!mobi_is_dictionary(m_mobiData))
+    return MOBI_FILE_UNSUPPORTED;
+
+  *orth = mobi_init_indx();
+  if (*orth == nullptr)
+    return MOBI_MALLOC_FAILED;
+
+  MOBI_RET mobi_ret =
+      mobi_parse_index(m_mobiData, *orth, *m_mobiData->mh->orth_index);
+  if (mobi_ret != MOBI_SUCCESS || !mobi_exists_infl(m_mobiData))
+    return mobi_ret;
+
+  // Headwords are usable without their inflections
+  *infl = mobi_init_indx();
+  if (*infl != nullptr &&
+      mobi_parse_index(m_mobiData, *infl, *m_mobiData->mh->infl_index) !=
+          MOBI_SUCCESS) {
+    qWarning() << "Failed to parse the inflection index";
+    mobi_free_indx(*infl);
+    *infl = nullptr;
+  }
+
+  return MOBI_SUCCESS;
+}
+
+MOBI_RET MobiDict::loadOrthIndex(QStringList *labels,
+                                 QVector<MobiEntry> *entries)
+{
   if (!m_rawMarkup->orth)
     return MOBI_FILE_UNSUPPORTED;
 
@@ -156,75 +737,380 @@ MOBI_RET MobiDict::open()
   uint32_t entry_textlen  = 0;
 
   const size_t count = m_rawMarkup->orth->total_entries_count;
-
-#ifndef NDEBUG
-  QStringList multiples;
-#endif
+  labels->reserve(count);
+  entries->reserve(count);
 
   for (size_t i = 0; i < count; ++i) {
+    if (checkCanceled())
+      return MOBI_ERROR;
+
     const MOBIIndexEntry *orth_entry = &m_rawMarkup->orth->entries[i];
     entry_startpos = mobi_get_orth_entry_start_offset(orth_entry);
     entry_textlen  = mobi_get_orth_entry_text_length(orth_entry);
 
-    if (entry_startpos == 0 || entry_textlen == 0) {
-      ++i;
+    if (entry_startpos == 0 || entry_textlen == 0)
       continue;
-    }
-
-    QString label;
 
     if (m_isCP1252)
-      label = m_codec->toUnicode(orth_entry->label);
+      labels->append(m_codec->toUnicode(orth_entry->label));
     else
-      label = QString::fromUtf8(orth_entry->label);
-
-#ifndef NDEBUG
-    if (m_wordHash.constFind(label) != m_wordHash.constEnd())
-      multiples << label;
-#endif
+      labels->append(QString::fromUtf8(orth_entry->label));
 
-    MobiEntry *mobiEntry  = new MobiEntry;
-    mobiEntry->startPos   = entry_startpos;
-    mobiEntry->textLength = entry_textlen;
+    entries->append({entry_startpos, entry_textlen});
 
-    m_wordHash[label].append(mobiEntry);
+    if (labels->size() % kPublishChunk == 0)
+      publishWords(*labels, *entries, labels->size() - kPublishChunk);
 
     // qDebug("Adding %s", orth_entry->label);
   }
 
-  if (m_wordHash.isEmpty()) {
-    qWarning() << "Failed to find any word.";
-    return MOBI_DATA_CORRUPT;
+  const int published = labels->size() - labels->size() % kPublishChunk;
+  publishWords(*labels, *entries, published);
+
+  return MOBI_SUCCESS;
+}
+
+void MobiDict::buildInflections()
+{
+  // Warm starts skip the ORTH and INFL indexes, only inflections need them.
+  // They are parsed into indexes of this task's own then, m_rawMarkup must
+  // not change once open() has returned.
+  MOBIIndx *orth   = m_rawMarkup->orth;
+  MOBIIndx *infl   = orth != nullptr ? m_rawMarkup->infl : nullptr;
+  const bool owned = orth == nullptr;
+
+  if (owned && parseOrthIndex(&orth, &infl) != MOBI_SUCCESS) {
+    mobi_free_indx(orth);
+    mobi_free_indx(infl);
+    return;
   }
 
-#ifndef NDEBUG
-  qDebug() << "Dictionary loaded in" << timer.elapsed() << "miliseconds";
-  qDebug() << "Here are the words with multiple entries:";
-  qDebug() << multiples;
-#endif
+  QStringList forms;
+  QStringList headwords;
 
-  return MOBI_SUCCESS;
+  // Each inflection is a rule applied to the headword label, see
+  // mobi_reconstruct_infl()
+  const size_t count =
+      orth != nullptr && infl != nullptr ? orth->total_entries_count : 0;
+
+  for (size_t i = 0; i < count && !m_closing; ++i) {
+
+    const MOBIIndexEntry *entry = &orth->entries[i];
+    const size_t labelLength    = strlen(entry->label);
+
+    uint32_t *groups        = nullptr;
+    const size_t groupCount = mobi_get_indxentry_tagarray(
+        &groups, entry, INDX_TAGARR_ORTH_INFL);
+
+    if (groupCount == 0 || labelLength > INDX_INFLBUF_SIZEMAX)
+      continue;
+
+    const QString headword = decode(QByteArray(entry->label));
+
+    for (size_t g = 0; g < groupCount; ++g) {
+      if (groups[g] >= infl->entries_count)
+        continue;
+
+      uint32_t *parts        = nullptr;
+      const size_t partCount = mobi_get_indxentry_tagarray(
+          &parts, &infl->entries[groups[g]], INDX_TAGARR_INFL_PARTS_V2);
+
+      for (size_t p = 0; p < partCount; ++p) {
+        if (parts[p] >= infl->entries_count)
+          continue;
+
+        unsigned char decoded[INDX_INFLBUF_SIZEMAX + 1];
+        memcpy(decoded, entry->label, labelLength);
+        int decodedLength = int(labelLength);
+
+        const unsigned char *rule =
+            reinterpret_cast<unsigned char *>(infl->entries[parts[p]].label);
+        if (mobi_decode_infl(decoded, &decodedLength, rule) != MOBI_SUCCESS ||
+            decodedLength <= 0)
+          continue;
+
+        forms.append(decode(QByteArray(
+            reinterpret_cast<const char *>(decoded), decodedLength)));
+        headwords.append(headword);
+      }
+    }
+  }
+
+  if (owned) {
+    mobi_free_indx(orth);
+    mobi_free_indx(infl);
+  }
+
+  if (m_closing)
+    return;
+
+  m_inflections.build(forms, headwords);
+
+  // Saved even when empty, warm starts need it
+  IndexCache::save(m_inflCache->fileName(),
+                   m_inflCache->serialize({m_inflections.data()}));
+  m_inflectionsReady = true;
 }
 
-const QString &MobiDict::title()
+void MobiDict::publishWords(const QStringList &labels,
+                            const QVector<MobiEntry> &entries, int from)
 {
-  return m_title;
+  if (from >= labels.size())
+    return;
+
+  // Folded outside of the lock, searches go on meanwhile
+  QStringList keys;
+  keys.reserve(labels.size() - from);
+  for (int i = from; i < labels.size(); ++i)
+    keys.append(PrefixIndex::fold(labels[i]));
+
+  QMutexLocker locker(&m_partialMutex);
+  m_partialWords.append(labels.mid(from));
+  m_partialKeys.append(keys);
+  m_partialEntries += entries.mid(from);
+
+  const int count = m_partialWords.size();
+  locker.unlock();
+
+  emit wordsPublished(count);
+}
+
+QVector<MobiEntry> MobiDict::partialEntries(const QString &word) const
+{
+  const QString key = PrefixIndex::fold(word);
+  QVector<MobiEntry> exact;
+  QVector<MobiEntry> folded;
+
+  QMutexLocker locker(&m_partialMutex);
+  for (int i = 0; i < m_partialWords.size(); ++i) {
+    if (m_partialWords[i] == word)
+      exact.append(m_partialEntries[i]);
+    else if (m_partialKeys[i] == key)
+      folded.append(m_partialEntries[i]);
+  }
+
+  return exact.isEmpty() ? folded : exact;
 }
 
-const QList<QString> MobiDict::words()
+QCollator MobiDict::collator() const
 {
-  QList<QString> keys = m_wordHash.keys();
   QCollator sorter;
 
   sorter.setLocale(QLocale(m_language));
   sorter.setIgnorePunctuation(true);
   sorter.setNumericMode(true);
   sorter.setCaseSensitivity(Qt::CaseInsensitive);
-  std::sort(keys.begin(), keys.end(), [&](const QString &a, const QString &b) {
-    return sorter.compare(a, b) < 0;
-  });
 
-  return keys;
+  return sorter;
+}
+
+void MobiDict::buildOffsetIndex()
+{
+  m_offsets.clear();
+  m_offsets.reserve(m_store.entryCount());
+
+  for (int rank = 0; rank < m_store.count(); ++rank) {
+    int count                = 0;
+    const MobiEntry *entries = m_store.entries(rank, &count);
+
+    for (int i = 0; i < count; ++i)
+      m_offsets.append({entries[i].startPos, entries[i].textLength, rank});
+  }
+
+  std::sort(m_offsets.begin(), m_offsets.end(),
+            [](const MobiOffset &a, const MobiOffset &b) {
+              return a.startPos < b.startPos;
+            });
+}
+
+void MobiDict::loadTextIndex()
+{
+  if (m_textCache == nullptr)
+    m_textCache = new IndexCache(m_path, m_deviceSerial, "fts");
+
+  if (m_textCache->open() && m_textCache->imageCount() == 1 &&
+      m_textIndex.attach(m_textCache->imageData(), m_textCache->imageSize()) &&
+      m_textIndex.entryCount() == m_offsets.size()) {
+    m_textIndexReady = true;
+    return;
+  }
+
+  m_textIndex.clear();
+  m_textCache->close();
+
+#ifndef NDEBUG
+  QElapsedTimer timer;
+  timer.start();
+#endif
+
+  const auto text = [this](int id) { return entryText(id); };
+  if (!m_textIndex.build(m_offsets.size(), text, &m_closing))
+    return;
+
+#ifndef NDEBUG
+  qDebug() << "Text index built in" << timer.elapsed() << "miliseconds";
+#endif
+
+  IndexCache::save(m_textCache->fileName(),
+                   m_textCache->serialize({m_textIndex.data()}));
+  m_textIndexReady = true;
+}
+
+QString MobiDict::decode(const QByteArray &data) const
+{
+  if (m_isCP1252)
+    return m_codec->toUnicode(data);
+
+  return QString::fromUtf8(data);
+}
+
+QString MobiDict::entryText(int id) const
+{
+  const MobiOffset &offset = m_offsets[id];
+  QByteArray data;
+
+  if (m_textReader != nullptr) {
+    if (!m_textReader->read(offset.startPos, offset.textLength, &data))
+      return QString::null;
+  }
+  else
+    data = QByteArray::fromRawData(m_rawMarkup->flow->data + offset.startPos,
+                                   offset.textLength);
+
+  return toPlainText(decode(data));
+}
+
+int MobiDict::wordCount() const
+{
+  return m_store.count();
+}
+
+QString MobiDict::word(int rank) const
+{
+  return m_store.word(rank);
+}
+
+QStringList MobiDict::words(const QVector<int> &ranks) const
+{
+  QStringList result;
+  result.reserve(ranks.size());
+  for (int rank : ranks)
+    result.append(m_store.word(rank));
+
+  return result;
+}
+
+const PrefixIndex &MobiDict::prefixIndex() const
+{
+  return m_prefixIndex;
+}
+
+qint64 MobiDict::memoryUsage() const
+{
+  qint64 usage = 0;
+
+  // Mapped records are paged in on demand and shared with the page cache
+  if (m_mobiData != nullptr && m_map == nullptr) {
+    for (const MOBIPdbRecord *r = m_mobiData->rec; r != nullptr; r = r->next)
+      usage += r->size;
+  }
+
+  if (m_rawMarkup != nullptr && m_rawMarkup->flow != nullptr)
+    usage += m_rawMarkup->flow->size;
+
+  if (m_textReader != nullptr)
+    usage += m_textReader->memoryUsage();
+
+  // Headwords are held by the store, folded copies of them by the prefix
+  // index. Both hold no data of their own when mapped from the cache.
+  qint64 indexSize = m_store.data().size() + m_prefixIndex.data().size();
+  if (indexSize == 0 && m_indexCache != nullptr && m_indexCache->isOpen())
+    indexSize = m_indexCache->imageSize(0) + m_indexCache->imageSize(1);
+
+  usage += indexSize;
+
+  usage += m_offsets.size() * sizeof(MobiOffset);
+
+  // Only freshly built indexes are resident, mapped ones are paged in
+  if (m_textIndexReady)
+    usage += m_textIndex.data().size();
+
+  if (m_inflectionsReady)
+    usage += m_inflections.data().size();
+
+  return usage;
+}
+
+bool MobiDict::isLoaded() const
+{
+  return m_loaded;
+}
+
+bool MobiDict::isMapped() const
+{
+  return m_map != nullptr;
+}
+
+void MobiDict::cancel()
+{
+  m_cancel = true;
+}
+
+void MobiDict::resume()
+{
+  m_cancel = false;
+}
+
+bool MobiDict::wasCanceled() const
+{
+  return m_canceled;
+}
+
+void MobiDict::waitForInflections()
+{
+  m_inflFuture.waitForFinished();
+}
+
+bool MobiDict::checkCanceled()
+{
+  // Only open() sets it, once it gives up there is no going back
+  if (m_cancel)
+    m_canceled = true;
+
+  return m_canceled;
+}
+
+QStringList MobiDict::partialMatches(const QString &word) const
+{
+  const QString prefix = PrefixIndex::fold(word);
+  QStringList result;
+
+  QMutexLocker locker(&m_partialMutex);
+  for (int i = 0; i < m_partialWords.size(); ++i) {
+    if (!m_partialKeys[i].startsWith(prefix))
+      continue;
+
+    if (result.isEmpty() || result.last() != m_partialWords[i])
+      result.append(m_partialWords[i]);
+  }
+
+  return result;
+}
+
+QString MobiDict::stageName(int stage)
+{
+  switch (stage) {
+    case ReadingFile:
+      return "reading file";
+    case ParsingText:
+      return "parsing text";
+    case ReadingHeadwords:
+      return "reading headwords";
+    case IndexingHeadwords:
+      return "indexing headwords";
+    default:
+      return QString::null;
+  }
 }
 
 MOBIPart *MobiDict::getResourceByUid(const size_t &uid)
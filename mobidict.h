@@ -1,35 +1,116 @@
 #ifndef MOBIDICT_H
 #define MOBIDICT_H
 
-#include <QHash>
+#include <QFile>
+#include <QFuture>
+#include <QMutex>
 #include <QObject>
 #include <QString>
+#include <QStringList>
 #include <QTextCodec>
+#include <QVector>
 
 #include <mobi.h>
 
+#include <atomic>
+
+#include "fuzzyindex.h"
+#include "inflectionindex.h"
+#include "prefixindex.h"
+#include "textindex.h"
+#include "wordstore.h"
+
 typedef struct {
   uint32_t startPos;
   uint32_t textLength;
-} MobiEntry;
+  int rank;
+} MobiOffset;
+
+class IndexCache;
+class TextRecordReader;
 
 class MobiDict : public QObject {
+  Q_OBJECT
+
  public:
+  enum LoadStage {
+    ReadingFile,
+    ParsingText,
+    ReadingHeadwords,
+    IndexingHeadwords
+  };
+
   MobiDict(const QString&, const QString&);
   ~MobiDict();
 
+  // Headwords become searchable with partialMatches() and lookupWord() as
+  // they are published, everything else waits for isLoaded()
   MOBI_RET open();
+  bool isLoaded() const;
+  // Records are read from a memory mapped file rather than copied to memory
+  bool isMapped() const;
+  QStringList partialMatches(const QString&) const;
   const QString& title();
 
+  // Safe from any thread. open() checks for it between its phases and gives
+  // up with MOBI_ERROR, unless resume() takes it back before then.
+  void cancel();
+  void resume();
+  bool wasCanceled() const;
+
   MOBIPart* getResourceByUid(const size_t& uid);
 
-  const QList<QString> words();
-  QString resolveLink(const QString&);
-  QString lookupWord(const QString&);
+  int wordCount() const;
+  QString word(int rank) const;
+  QStringList words(const QVector<int>& ranks) const;
+  const PrefixIndex& prefixIndex() const;
+  // Headwords are in its order
+  QCollator collator() const;
+  qint64 memoryUsage() const;
+  QString resolveLink(const QString&) const;
+  // Inflected forms without an entry of their own, like "went", resolve to
+  // the entries of their headwords
+  QString lookupWord(const QString&, QStringList* resources = nullptr) const;
+  QStringList baseForms(const QString&) const;
+  // Inflections missing from the cache are decoded in the background after
+  // open(), base forms are only found once they are
+  void waitForInflections();
+  QStringList suggestions(const QString&, int limit) const;
+
+  // Full-text search over the definitions, see TextIndex for the syntax. The
+  // index is loaded or built in the background on first use.
+  void buildTextIndex();
+  bool isTextIndexReady() const;
+  QVector<int> searchText(const QString& query) const;
+
+  static QString toPlainText(const QString& html);
+  static QString stageName(int stage);
+
+ signals:
+  void stageChanged(int stage);
+  void wordsPublished(int count);
 
  private:
+  bool checkCanceled();
+  MOBI_RET loadMapped(FILE*);
+  void detachRecords();
+  MOBI_RET parseOrthIndex(MOBIIndx** orth, MOBIIndx** infl) const;
+  MOBI_RET loadOrthIndex(QStringList*, QVector<MobiEntry>*);
+  void buildInflections();
+  void publishWords(const QStringList& labels,
+                    const QVector<MobiEntry>& entries, int from);
+  QVector<MobiEntry> partialEntries(const QString&) const;
+  void buildOffsetIndex();
+  void loadTextIndex();
+  QString decode(const QByteArray&) const;
+  QString entryText(int id) const;
+
+  QFile m_file;
+  uchar* m_map;
+
   MOBIData* m_mobiData;
   MOBIRawml* m_rawMarkup;
+  TextRecordReader* m_textReader;
 
   QString m_deviceSerial;
   QString m_language;
@@ -38,7 +119,32 @@ class MobiDict : public QObject {
 
   bool m_isCP1252;
 
-  QHash<QString, QList<MobiEntry*>> m_wordHash;
+  std::atomic<bool> m_loaded;
+  // Asked for by cancel(), and whether open() gave up because of it
+  std::atomic<bool> m_cancel;
+  std::atomic<bool> m_canceled;
+
+  // Headwords in ORTH order with their folded keys, while loading
+  mutable QMutex m_partialMutex;
+  QStringList m_partialWords;
+  QStringList m_partialKeys;
+  QVector<MobiEntry> m_partialEntries;
+
+  IndexCache* m_indexCache;
+  WordStore m_store;
+  PrefixIndex m_prefixIndex;
+  FuzzyIndex m_fuzzyIndex;
+  QFuture<void> m_fuzzyFuture;
+  IndexCache* m_inflCache;
+  InflectionIndex m_inflections;
+  QFuture<void> m_inflFuture;
+  std::atomic<bool> m_inflectionsReady;
+  IndexCache* m_textCache;
+  TextIndex m_textIndex;
+  QFuture<void> m_textFuture;
+  std::atomic<bool> m_textIndexReady;
+  std::atomic<bool> m_closing;
+  QVector<MobiOffset> m_offsets;
   QTextCodec* m_codec;
 };
 
@@ -0,0 +1,258 @@
+#include <QStringList>
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+#include "prefixindex.h"
+#include "wordstore.h"
+
+namespace {
+
+enum { Keys, Positions, Table, Pool };
+
+// Binary (UTF-16) order, like QString::compare()
+int compare(const QChar *a, int aLength, const QChar *b, int bLength)
+{
+  const int length = std::min(aLength, bLength);
+  for (int i = 0; i < length; ++i) {
+    if (a[i] != b[i])
+      return a[i].unicode() < b[i].unicode() ? -1 : 1;
+  }
+
+  return aLength < bLength ? -1 : aLength > bLength ? 1 : 0;
+}
+
+}  // namespace
+
+PrefixIndex::PrefixIndex()
+    : m_image({sizeof(PrefixKey), sizeof(quint32), sizeof(qint32),
+               sizeof(QChar)})
+{
+  clear();
+}
+
+void PrefixIndex::build(const WordStore &store)
+{
+  clear();
+
+  const int count = store.count();
+
+  QStringList folded;
+  folded.reserve(count);
+  for (int rank = 0; rank < count; ++rank)
+    folded.append(fold(store.word(rank)));
+
+  QVector<int> order(count);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    return folded[a].compare(folded[b]) < 0;
+  });
+
+  quint32 poolSize = 0;
+  for (const auto &key : folded)
+    poolSize += key.size();
+
+  m_image.build({quint32(count), quint32(count), FlatImage::tableSize(count),
+                 poolSize});
+
+  PrefixKey *keys    = m_image.data<PrefixKey>(Keys);
+  quint32 *positions = m_image.data<quint32>(Positions);
+  QChar *pool        = m_image.data<QChar>(Pool);
+
+  quint32 poolOffset = 0;
+
+  for (int i = 0; i < count; ++i) {
+    const int rank     = order[i];
+    const QString &key = folded[rank];
+
+    keys[i].poolOffset = poolOffset;
+    keys[i].length     = key.size();
+    keys[i].rank       = rank;
+    positions[rank]    = i;
+
+    memcpy(pool + poolOffset, key.constData(), key.size() * sizeof(QChar));
+    poolOffset += key.size();
+  }
+
+  FlatImage::buildTable(m_image.data<qint32>(Table), m_image.count(Table),
+                        keys, count, pool);
+
+  const QByteArray &data = m_image.data();
+  attach(reinterpret_cast<const uchar *>(data.constData()), data.size());
+}
+
+bool PrefixIndex::attach(const uchar *data, qint64 size)
+{
+  if (!m_image.attach(data, size))
+    return false;
+
+  const quint32 count     = m_image.count(Keys);
+  const quint32 tableSize = m_image.count(Table);
+
+  const PrefixKey *keys    = m_image.section<PrefixKey>(Keys);
+  const quint32 *positions = m_image.section<quint32>(Positions);
+  const qint32 *table      = m_image.section<qint32>(Table);
+
+  bool valid = m_image.count(Positions) == count &&
+               FlatImage::isValid(keys, count, &PrefixKey::poolOffset,
+                                  &PrefixKey::length, m_image.count(Pool)) &&
+               FlatImage::isValidTable(table, tableSize, count);
+
+  // Ranks and positions must be each other's inverse
+  for (quint32 i = 0; valid && i < count; ++i)
+    valid = keys[i].rank < count && positions[keys[i].rank] == i;
+
+  if (!valid) {
+    clear();
+    return false;
+  }
+
+  m_keys      = keys;
+  m_positions = positions;
+  m_table     = table;
+  m_pool      = m_image.section<QChar>(Pool);
+  m_count     = count;
+  m_tableSize = tableSize;
+
+  return true;
+}
+
+void PrefixIndex::clear()
+{
+  m_image.clear();
+
+  m_keys      = nullptr;
+  m_positions = nullptr;
+  m_table     = nullptr;
+  m_pool      = nullptr;
+  m_count     = 0;
+  m_tableSize = 0;
+}
+
+int PrefixIndex::count() const
+{
+  return m_count;
+}
+
+PrefixIndex::Range PrefixIndex::all() const
+{
+  return {0, int(m_count)};
+}
+
+PrefixIndex::Range PrefixIndex::find(const QString &folded) const
+{
+  return find(folded, all());
+}
+
+PrefixIndex::Range PrefixIndex::find(const QString &folded,
+                                     const Range &within) const
+{
+  const int length     = folded.size();
+  const QChar *prefix  = folded.constData();
+  const PrefixKey *end = m_keys + within.end;
+
+  const auto head = [length](const PrefixKey &key) {
+    return qMin(int(key.length), length);
+  };
+
+  const PrefixKey *lower = std::lower_bound(
+      m_keys + within.begin, end, folded,
+      [&](const PrefixKey &key, const QString &) {
+        return compare(m_pool + key.poolOffset, head(key), prefix, length) < 0;
+      });
+  const PrefixKey *upper = std::upper_bound(
+      lower, end, folded, [&](const QString &, const PrefixKey &key) {
+        return compare(prefix, length, m_pool + key.poolOffset, head(key)) < 0;
+      });
+
+  return {int(lower - m_keys), int(upper - m_keys)};
+}
+
+PrefixIndex::Range PrefixIndex::findExact(const QString &folded) const
+{
+  const int index =
+      FlatImage::find(m_table, m_tableSize, m_keys, m_pool, folded);
+  if (index < 0)
+    return {0, 0};
+
+  // Equal keys are adjacent, the table finds any of them
+  Range range = {index, index + 1};
+  while (range.begin > 0 && isKey(range.begin - 1, folded))
+    --range.begin;
+  while (range.end < int(m_count) && isKey(range.end, folded))
+    ++range.end;
+
+  return range;
+}
+
+QVector<int> PrefixIndex::ranks(const Range &range) const
+{
+  return ranks(range, range.end - range.begin);
+}
+
+QVector<int> PrefixIndex::ranks(const Range &range, int limit) const
+{
+  QVector<int> result;
+  result.reserve(range.end - range.begin);
+  for (int i = range.begin; i < range.end; ++i)
+    result.append(m_keys[i].rank);
+
+  // Back to collation order, only as far as asked for
+  limit = qBound(0, limit, result.size());
+  if (limit == result.size()) {
+    std::sort(result.begin(), result.end());
+    return result;
+  }
+
+  std::partial_sort(result.begin(), result.begin() + limit, result.end());
+  result.resize(limit);
+  return result;
+}
+
+QString PrefixIndex::key(int rank) const
+{
+  const PrefixKey &key = m_keys[m_positions[rank]];
+  return QString::fromRawData(m_pool + key.poolOffset, key.length);
+}
+
+const QByteArray &PrefixIndex::data() const
+{
+  return m_image.data();
+}
+
+QString PrefixIndex::fold(const QString &word)
+{
+  // Most headwords are ASCII, which only needs case folding
+  bool ascii = true;
+  for (const QChar c : word) {
+    if (c.unicode() >= 0x80) {
+      ascii = false;
+      break;
+    }
+  }
+
+  if (ascii)
+    return word.toCaseFolded();
+
+  // Decompose to drop the accents, then recompose what is left. Only the
+  // Latin, Greek and Cyrillic diacritics are dropped, other non-spacing marks
+  // such as Indic vowel signs or Hebrew points tell words apart.
+  const QString decomposed = word.normalized(QString::NormalizationForm_KD);
+
+  QString stripped;
+  stripped.reserve(decomposed.size());
+  for (const QChar c : decomposed) {
+    if (c.unicode() < 0x0300 || c.unicode() > 0x036f)
+      stripped.append(c);
+  }
+
+  return stripped.toCaseFolded().normalized(QString::NormalizationForm_KC);
+}
+
+bool PrefixIndex::isKey(int index, const QString &folded) const
+{
+  const PrefixKey &key = m_keys[index];
+  return compare(m_pool + key.poolOffset, key.length, folded.constData(),
+                 folded.size()) == 0;
+}
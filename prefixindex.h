@@ -0,0 +1,77 @@
+#ifndef PREFIXINDEX_H
+#define PREFIXINDEX_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include "flatimage.h"
+
+class WordStore;
+
+typedef struct {
+  quint32 poolOffset;
+  quint32 length;
+  quint32 rank;
+} PrefixKey;
+
+// Case and accent insensitive prefix search over the headwords of a
+// dictionary.
+//
+// Keys are folded (see fold()) and kept in binary (UTF-16) order, each
+// remembering the collation rank of its headword. A prefix query is a pair of
+// binary searches and yields a contiguous range of keys; a longer prefix can
+// be searched within the range of a shorter one. Whole keys are also hashed
+// for constant time tolerant lookups.
+//
+// Like WordStore, everything lives in one FlatImage that is kept next to it in
+// the index cache:
+//
+//   PrefixKey[keys] | quint32[positions] | qint32[table] | QChar[pool]
+//
+// Positions map a rank back to its key.
+class PrefixIndex {
+ public:
+  typedef struct {
+    int begin;
+    int end;
+  } Range;
+
+  PrefixIndex();
+
+  void build(const WordStore&);
+  bool attach(const uchar* data, qint64 size);
+  void clear();
+
+  int count() const;
+  Range all() const;
+  Range find(const QString& folded) const;
+  Range find(const QString& folded, const Range& within) const;
+  Range findExact(const QString& folded) const;
+  QVector<int> ranks(const Range&) const;
+  // Only the first ones in collation order
+  QVector<int> ranks(const Range&, int limit) const;
+  // Folded headword of a rank, only valid as long as the index
+  QString key(int rank) const;
+
+  const QByteArray& data() const;
+
+  // NFKC normalized, case folded and without the combining diacritical marks
+  // (U+0300 to U+036F)
+  static QString fold(const QString&);
+
+ private:
+  bool isKey(int index, const QString& folded) const;
+
+  FlatImage m_image;
+
+  const PrefixKey* m_keys;
+  const quint32* m_positions;
+  const qint32* m_table;
+  const QChar* m_pool;
+
+  quint32 m_count;
+  quint32 m_tableSize;
+};
+
+#endif
@@ -15,6 +15,9 @@ Settings::Settings(QWidget* parent, QSettings* settings)
   m_ui->serialNumber->setToolTip(
       "For <b>your own</b> dictionaries with DRM, enter your e-reader's serial "
       "number here.");
+  m_ui->regexSearch->setToolTip(
+      "Match words with a regular expression instead of by prefix. This is "
+      "much slower on large dictionaries.");
   connect(this, &QDialog::accepted, this, &Settings::saveSettings);
 }
 
@@ -31,10 +34,12 @@ void Settings::showEvent(QShowEvent* ev)
   int fontSize = m_settings->value("viewer/fontSize", 18).toInt();
   QString deviceSerial =
       m_settings->value("viewer/deviceSerial", QString()).toString();
+  bool regexSearch = m_settings->value("viewer/regexSearch", false).toBool();
 
   m_ui->fontComboBox->setCurrentFont(QFont(fontName, fontSize));
   m_ui->serialNumber->setText(deviceSerial);
   m_ui->pointComboBox->setCurrentText(QString::number(fontSize));
+  m_ui->regexSearch->setChecked(regexSearch);
 
   QDialog::showEvent(ev);
 }
@@ -44,9 +49,11 @@ void Settings::saveSettings()
   QString fontName     = m_ui->fontComboBox->currentFont().family();
   int pointSize        = m_ui->pointComboBox->currentText().toUInt(nullptr);
   QString deviceSerial = m_ui->serialNumber->text().remove(' ');
+  bool regexSearch     = m_ui->regexSearch->isChecked();
 
   m_settings->setValue("viewer/fontName", fontName);
   m_settings->setValue("viewer/fontSize", pointSize);
   m_settings->setValue("viewer/deviceSerial", deviceSerial);
+  m_settings->setValue("viewer/regexSearch", regexSearch);
   m_settings->sync();
 }
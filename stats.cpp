@@ -0,0 +1,227 @@
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QtAlgorithms>
+
+#include <atomic>
+
+#include "stats.h"
+
+namespace {
+
+// Up to 2^48 ns, a few days
+const int kBuckets = 48;
+
+typedef struct {
+  std::atomic<quint64> count;
+  std::atomic<quint64> total;
+  std::atomic<quint64> max;
+  std::atomic<quint64> buckets[kBuckets];
+} Slot;
+
+// Zero initialized, before any static constructor runs
+Slot g_operations[Stats::OperationCount];
+std::atomic<quint64> g_counters[Stats::CounterCount];
+
+const char *kOperationNames[] = {"load",
+                                 "load.read",
+                                 "load.drm",
+                                 "load.rawml",
+                                 "load.index",
+                                 "match",
+                                 "lookup",
+                                 "lookup.rewrite",
+                                 "resource.decode",
+                                 "render",
+                                 "serve"};
+
+const char *kCounterNames[] = {"entryCache.hits", "entryCache.misses",
+                               "imageCache.hits", "imageCache.misses"};
+
+static_assert(sizeof(kOperationNames) / sizeof(*kOperationNames) ==
+                  Stats::OperationCount,
+              "Every operation needs a name");
+static_assert(sizeof(kCounterNames) / sizeof(*kCounterNames) ==
+                  Stats::CounterCount,
+              "Every counter needs a name");
+
+double toMilliseconds(quint64 nsecs)
+{
+  return nsecs / 1e6;
+}
+
+}  // namespace
+
+void Stats::record(Operation operation, qint64 nsecs)
+{
+  const quint64 value = quint64(qMax<qint64>(nsecs, 1));
+  Slot &slot          = g_operations[operation];
+
+  const int bucket =
+      qMin(kBuckets - 1, 63 - int(qCountLeadingZeroBits(value)));
+
+  slot.count.fetch_add(1, std::memory_order_relaxed);
+  slot.total.fetch_add(value, std::memory_order_relaxed);
+  slot.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+
+  // Retried until stored or beaten by a slower one
+  quint64 max = slot.max.load(std::memory_order_relaxed);
+  while (value > max) {
+    if (slot.max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+      break;
+  }
+}
+
+void Stats::count(Counter counter, quint64 n)
+{
+  g_counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+void Stats::reset()
+{
+  for (auto &slot : g_operations) {
+    slot.count = 0;
+    slot.total = 0;
+    slot.max   = 0;
+
+    for (auto &bucket : slot.buckets)
+      bucket = 0;
+  }
+
+  for (auto &counter : g_counters)
+    counter = 0;
+}
+
+Stats::Histogram Stats::histogram(Operation operation)
+{
+  const Slot &slot = g_operations[operation];
+
+  Histogram h;
+  h.count = slot.count.load(std::memory_order_relaxed);
+  h.total = slot.total.load(std::memory_order_relaxed);
+  h.max   = slot.max.load(std::memory_order_relaxed);
+
+  h.buckets.reserve(kBuckets);
+  for (const auto &bucket : slot.buckets)
+    h.buckets.append(bucket.load(std::memory_order_relaxed));
+
+  return h;
+}
+
+quint64 Stats::counter(Counter counter)
+{
+  return g_counters[counter].load(std::memory_order_relaxed);
+}
+
+quint64 Stats::percentile(const Histogram &h, double fraction)
+{
+  quint64 total = 0;
+  for (quint64 n : h.buckets)
+    total += n;
+
+  if (total == 0)
+    return 0;
+
+  // Upper bound of the bucket holding the percentile, but never past the
+  // slowest one recorded
+  const quint64 target = qMax<quint64>(1, quint64(fraction * total + 0.5));
+  quint64 seen         = 0;
+
+  for (int i = 0; i < h.buckets.size(); ++i) {
+    seen += h.buckets[i];
+    if (seen >= target)
+      return qMin(h.max, (quint64(2) << i) - 1);
+  }
+
+  return h.max;
+}
+
+QString Stats::name(Operation operation)
+{
+  return QString::fromLatin1(kOperationNames[operation]);
+}
+
+QString Stats::name(Counter counter)
+{
+  return QString::fromLatin1(kCounterNames[counter]);
+}
+
+QJsonObject Stats::toJson()
+{
+  QJsonObject operations;
+
+  for (int i = 0; i < OperationCount; ++i) {
+    const Histogram h = histogram(Operation(i));
+    if (h.count == 0)
+      continue;
+
+    QJsonArray buckets;
+    for (quint64 n : h.buckets)
+      buckets.append(double(n));
+
+    QJsonObject o;
+    o["count"]   = double(h.count);
+    o["meanMs"]  = toMilliseconds(h.total) / h.count;
+    o["p50Ms"]   = toMilliseconds(percentile(h, 0.5));
+    o["p90Ms"]   = toMilliseconds(percentile(h, 0.9));
+    o["p99Ms"]   = toMilliseconds(percentile(h, 0.99));
+    o["maxMs"]   = toMilliseconds(h.max);
+    o["buckets"] = buckets;
+
+    operations[name(Operation(i))] = o;
+  }
+
+  QJsonObject counters;
+  for (int i = 0; i < CounterCount; ++i)
+    counters[name(Counter(i))] = double(counter(Counter(i)));
+
+  QJsonObject result;
+  result["operations"] = operations;
+  result["counters"]   = counters;
+
+  return result;
+}
+
+bool Stats::dump(const QString &fileName)
+{
+  QDir().mkpath(QFileInfo(fileName).absolutePath());
+
+  QSaveFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly))
+    return false;
+
+  file.write(QJsonDocument(toJson()).toJson());
+  return file.commit();
+}
+
+ScopedTimer::ScopedTimer(Stats::Operation operation)
+{
+  m_operation = operation;
+  m_running   = true;
+  m_timer.start();
+}
+
+ScopedTimer::~ScopedTimer()
+{
+  stop();
+}
+
+void ScopedTimer::next(Stats::Operation operation)
+{
+  stop();
+
+  m_operation = operation;
+  m_running   = true;
+  m_timer.start();
+}
+
+void ScopedTimer::stop()
+{
+  if (!m_running)
+    return;
+
+  Stats::record(m_operation, m_timer.nsecsElapsed());
+  m_running = false;
+}
@@ -0,0 +1,76 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QString>
+#include <QVector>
+
+// Process wide latency histograms and counters of the hot paths.
+//
+// Recording is a handful of relaxed atomic increments, cheap enough to stay
+// in release builds and safe from any thread. Latencies go to power of two
+// buckets of nanoseconds, so percentiles are accurate to a factor of two.
+class Stats {
+ public:
+  enum Operation {
+    Load,
+    LoadRead,
+    LoadDrm,
+    LoadRawml,
+    LoadIndex,
+    Matches,
+    Lookup,
+    RewriteHtml,
+    DecodeResource,
+    Render,
+    Serve,
+    OperationCount
+  };
+
+  enum Counter {
+    EntryCacheHits,
+    EntryCacheMisses,
+    ImageCacheHits,
+    ImageCacheMisses,
+    CounterCount
+  };
+
+  typedef struct {
+    quint64 count;
+    quint64 total;
+    quint64 max;
+    QVector<quint64> buckets;
+  } Histogram;
+
+  static void record(Operation, qint64 nsecs);
+  static void count(Counter, quint64 n = 1);
+  static void reset();
+
+  static Histogram histogram(Operation);
+  static quint64 counter(Counter);
+  static quint64 percentile(const Histogram&, double fraction);
+
+  static QString name(Operation);
+  static QString name(Counter);
+
+  static QJsonObject toJson();
+  static bool dump(const QString& fileName);
+};
+
+// Records the time until it goes out of scope, or between phases
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(Stats::Operation);
+  ~ScopedTimer();
+
+  void next(Stats::Operation);
+  void stop();
+
+ private:
+  Stats::Operation m_operation;
+  QElapsedTimer m_timer;
+  bool m_running;
+};
+
+#endif
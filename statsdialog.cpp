@@ -0,0 +1,97 @@
+#include <QPushButton>
+
+#include "stats.h"
+#include "statsdialog.h"
+
+static const int kRefreshInterval = 1000;
+
+static QString formatMilliseconds(quint64 nsecs)
+{
+  return QString::number(nsecs / 1e6, 'f', 2);
+}
+
+StatsDialog::StatsDialog(QWidget* parent)
+    : QDialog(parent), m_ui(new Ui::StatsDialog)
+{
+  m_ui->setupUi(this);
+
+  m_ui->statsTable->setColumnCount(7);
+  m_ui->statsTable->setHorizontalHeaderLabels({"Operation", "Count",
+                                               "Mean (ms)", "p50 (ms)",
+                                               "p90 (ms)", "p99 (ms)",
+                                               "Max (ms)"});
+  m_ui->statsTable->horizontalHeader()->setSectionResizeMode(
+      QHeaderView::ResizeToContents);
+
+  m_refreshTimer.setInterval(kRefreshInterval);
+  connect(&m_refreshTimer, &QTimer::timeout, this, &StatsDialog::refresh);
+  connect(m_ui->buttonBox, &QDialogButtonBox::clicked, this,
+          &StatsDialog::buttonClicked);
+}
+
+StatsDialog::~StatsDialog()
+{
+  delete m_ui;
+  m_ui = nullptr;
+}
+
+void StatsDialog::showEvent(QShowEvent* ev)
+{
+  refresh();
+  m_refreshTimer.start();
+
+  QDialog::showEvent(ev);
+}
+
+void StatsDialog::hideEvent(QHideEvent* ev)
+{
+  m_refreshTimer.stop();
+
+  QDialog::hideEvent(ev);
+}
+
+void StatsDialog::buttonClicked(QAbstractButton* button)
+{
+  if (m_ui->buttonBox->buttonRole(button) != QDialogButtonBox::ResetRole)
+    return;
+
+  Stats::reset();
+  refresh();
+}
+
+void StatsDialog::refresh()
+{
+  QTableWidget* table = m_ui->statsTable;
+  table->setRowCount(Stats::OperationCount + Stats::CounterCount);
+
+  const auto setRow = [table](int row, const QStringList& cells) {
+    for (int column = 0; column < cells.size(); ++column) {
+      QTableWidgetItem* item = new QTableWidgetItem(cells[column]);
+      if (column > 0)
+        item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+
+      table->setItem(row, column, item);
+    }
+  };
+
+  for (int i = 0; i < Stats::OperationCount; ++i) {
+    const Stats::Histogram h = Stats::histogram(Stats::Operation(i));
+    const quint64 mean       = h.count > 0 ? h.total / h.count : 0;
+
+    setRow(i, {Stats::name(Stats::Operation(i)), QString::number(h.count),
+               formatMilliseconds(mean),
+               formatMilliseconds(Stats::percentile(h, 0.5)),
+               formatMilliseconds(Stats::percentile(h, 0.9)),
+               formatMilliseconds(Stats::percentile(h, 0.99)),
+               formatMilliseconds(h.max)});
+  }
+
+  for (int i = 0; i < Stats::CounterCount; ++i) {
+    const Stats::Counter counter = Stats::Counter(i);
+
+    // Latency columns do not apply
+    setRow(Stats::OperationCount + i,
+           {Stats::name(counter), QString::number(Stats::counter(counter)),
+            QString(), QString(), QString(), QString(), QString()});
+  }
+}
@@ -0,0 +1,34 @@
+#ifndef STATSDIALOG_H
+#define STATSDIALOG_H
+
+#include <QDialog>
+#include <QTimer>
+
+#include "ui_statsdialog.h"
+
+class QAbstractButton;
+class QHideEvent;
+class QShowEvent;
+
+// Latency histograms and counters of Stats, refreshed while shown
+class StatsDialog : public QDialog {
+  Q_OBJECT
+
+ public:
+  explicit StatsDialog(QWidget* parent);
+  ~StatsDialog();
+
+ private slots:
+  void refresh();
+  void buttonClicked(QAbstractButton*);
+
+ protected:
+  void showEvent(QShowEvent*) override;
+  void hideEvent(QHideEvent*) override;
+
+ private:
+  Ui::StatsDialog* m_ui;
+  QTimer m_refreshTimer;
+};
+
+#endif
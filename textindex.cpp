@@ -0,0 +1,325 @@
+#include <QHash>
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include "prefixindex.h"
+#include "textindex.h"
+
+namespace {
+
+enum { Entries, Tokens, Postings, Pool };
+
+typedef struct {
+  QStringList tokens;
+  bool negated;
+} Clause;
+
+QVector<quint32> intersect(const QVector<quint32> &a, const QVector<quint32> &b)
+{
+  QVector<quint32> result;
+  std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                        std::back_inserter(result));
+  return result;
+}
+
+QVector<quint32> unite(const QVector<quint32> &a, const QVector<quint32> &b)
+{
+  QVector<quint32> result;
+  std::set_union(a.begin(), a.end(), b.begin(), b.end(),
+                 std::back_inserter(result));
+  return result;
+}
+
+QVector<quint32> subtract(const QVector<quint32> &a, const QVector<quint32> &b)
+{
+  QVector<quint32> result;
+  std::set_difference(a.begin(), a.end(), b.begin(), b.end(),
+                      std::back_inserter(result));
+  return result;
+}
+
+bool containsPhrase(const QStringList &tokens, const QStringList &phrase)
+{
+  return std::search(tokens.begin(), tokens.end(), phrase.begin(),
+                     phrase.end()) != tokens.end();
+}
+
+// Alternatives separated by OR, each a list of clauses that must all hold
+QList<QList<Clause>> parseQuery(const QString &query)
+{
+  QList<QList<Clause>> groups;
+  QList<Clause> group;
+
+  const int length = query.size();
+  int i            = 0;
+
+  while (i < length) {
+    if (query[i].isSpace()) {
+      ++i;
+      continue;
+    }
+
+    Clause clause;
+    clause.negated = query[i] == '-';
+    if (clause.negated)
+      ++i;
+
+    if (i < length && query[i] == '"') {
+      int end = query.indexOf('"', i + 1);
+      if (end < 0)
+        end = length;
+
+      clause.tokens = TextIndex::tokenize(query.mid(i + 1, end - i - 1));
+      i             = end + 1;
+    }
+    else {
+      int end = i;
+      while (end < length && !query[end].isSpace())
+        ++end;
+
+      const QString term = query.mid(i, end - i);
+      i                  = end;
+
+      if (term == "OR" && !clause.negated) {
+        groups.append(group);
+        group.clear();
+        continue;
+      }
+
+      // Terms like "e-mail" become phrases
+      clause.tokens = TextIndex::tokenize(term);
+    }
+
+    if (!clause.tokens.isEmpty())
+      group.append(clause);
+  }
+
+  groups.append(group);
+  return groups;
+}
+
+}  // namespace
+
+TextIndex::TextIndex()
+    : m_image({0, sizeof(TextToken), sizeof(quint32), sizeof(QChar)})
+{
+  clear();
+}
+
+bool TextIndex::build(int entryCount, const TextFunction &text,
+                      const std::atomic<bool> *cancel)
+{
+  clear();
+
+  QHash<QString, QVector<quint32>> postings;
+  quint32 postingCount = 0;
+
+  for (int id = 0; id < entryCount; ++id) {
+    if (cancel != nullptr && *cancel)
+      return false;
+
+    for (const auto &token : tokenize(text(id))) {
+      // Ids only grow, a repeated token can only be the last one
+      QVector<quint32> &list = postings[token];
+      if (list.isEmpty() || list.last() != quint32(id)) {
+        list.append(id);
+        ++postingCount;
+      }
+    }
+  }
+
+  QStringList tokens = postings.keys();
+  std::sort(tokens.begin(), tokens.end());
+
+  quint32 poolSize = 0;
+  for (const auto &token : tokens)
+    poolSize += token.size();
+
+  m_image.build({quint32(entryCount), quint32(tokens.size()), postingCount,
+                 poolSize});
+
+  TextToken *outTokens = m_image.data<TextToken>(Tokens);
+  quint32 *outPostings = m_image.data<quint32>(Postings);
+  QChar *pool          = m_image.data<QChar>(Pool);
+
+  quint32 poolOffset    = 0;
+  quint32 postingOffset = 0;
+
+  for (int i = 0; i < tokens.size(); ++i) {
+    const QString &token         = tokens[i];
+    const QVector<quint32> &list = postings[token];
+
+    TextToken &t   = outTokens[i];
+    t.poolOffset   = poolOffset;
+    t.length       = token.size();
+    t.firstPosting = postingOffset;
+    t.postingCount = list.size();
+
+    memcpy(pool + poolOffset, token.constData(), token.size() * sizeof(QChar));
+    poolOffset += token.size();
+
+    memcpy(outPostings + postingOffset, list.constData(),
+           list.size() * sizeof(quint32));
+    postingOffset += list.size();
+  }
+
+  const QByteArray &data = m_image.data();
+  return attach(reinterpret_cast<const uchar *>(data.constData()),
+                data.size());
+}
+
+bool TextIndex::attach(const uchar *data, qint64 size)
+{
+  if (!m_image.attach(data, size))
+    return false;
+
+  const quint32 entryCount   = m_image.count(Entries);
+  const quint32 tokenCount   = m_image.count(Tokens);
+  const quint32 postingCount = m_image.count(Postings);
+
+  const TextToken *tokens = m_image.section<TextToken>(Tokens);
+  const quint32 *postings = m_image.section<quint32>(Postings);
+
+  if (!FlatImage::isValid(tokens, tokenCount, &TextToken::poolOffset,
+                          &TextToken::length, m_image.count(Pool)) ||
+      !FlatImage::isValid(tokens, tokenCount, &TextToken::firstPosting,
+                          &TextToken::postingCount, postingCount)) {
+    clear();
+    return false;
+  }
+
+  for (quint32 i = 0; i < postingCount; ++i) {
+    if (postings[i] >= entryCount) {
+      clear();
+      return false;
+    }
+  }
+
+  m_tokens     = tokens;
+  m_postings   = postings;
+  m_pool       = m_image.section<QChar>(Pool);
+  m_entryCount = entryCount;
+  m_tokenCount = tokenCount;
+
+  return true;
+}
+
+void TextIndex::clear()
+{
+  m_image.clear();
+
+  m_tokens     = nullptr;
+  m_postings   = nullptr;
+  m_pool       = nullptr;
+  m_entryCount = 0;
+  m_tokenCount = 0;
+}
+
+int TextIndex::entryCount() const
+{
+  return m_entryCount;
+}
+
+QVector<quint32> TextIndex::postings(const QString &token) const
+{
+  const auto key = [this](const TextToken &t) {
+    return QString::fromRawData(m_pool + t.poolOffset, t.length);
+  };
+
+  const TextToken *end = m_tokens + m_tokenCount;
+  const TextToken *it  = std::lower_bound(
+      m_tokens, end, token, [&key](const TextToken &t, const QString &value) {
+        return key(t).compare(value) < 0;
+      });
+
+  if (it == end || key(*it) != token)
+    return QVector<quint32>();
+
+  QVector<quint32> result(it->postingCount);
+  memcpy(result.data(), m_postings + it->firstPosting,
+         it->postingCount * sizeof(quint32));
+
+  return result;
+}
+
+QVector<quint32> TextIndex::search(const QString &query,
+                                   const TextFunction &text) const
+{
+  QVector<quint32> result;
+
+  for (const auto &group : parseQuery(query)) {
+    QVector<quint32> candidates;
+    bool first = true;
+
+    // Narrow down with the postings of every wanted token, phrases included
+    for (const auto &clause : group) {
+      if (clause.negated)
+        continue;
+
+      for (const auto &token : clause.tokens) {
+        candidates = first ? postings(token)
+                           : intersect(candidates, postings(token));
+        first = false;
+      }
+    }
+
+    // Exclusions alone would match nearly everything
+    if (first)
+      continue;
+
+    for (const auto &clause : group) {
+      if (candidates.isEmpty())
+        break;
+
+      if (clause.negated && clause.tokens.size() == 1) {
+        candidates = subtract(candidates, postings(clause.tokens.first()));
+        continue;
+      }
+
+      if (clause.tokens.size() == 1)
+        continue;
+
+      // Phrases are kept or dropped by their occurrence in the entry
+      QVector<quint32> verified;
+      for (quint32 id : candidates) {
+        if (containsPhrase(tokenize(text(id)), clause.tokens) !=
+            clause.negated)
+          verified.append(id);
+      }
+
+      candidates = verified;
+    }
+
+    result = unite(result, candidates);
+  }
+
+  return result;
+}
+
+const QByteArray &TextIndex::data() const
+{
+  return m_image.data();
+}
+
+QStringList TextIndex::tokenize(const QString &text)
+{
+  QStringList tokens;
+  const int length = text.size();
+  int start        = -1;
+
+  for (int i = 0; i <= length; ++i) {
+    const bool inWord =
+        i < length && (text[i].isLetterOrNumber() || text[i].isMark());
+
+    if (inWord && start < 0)
+      start = i;
+    else if (!inWord && start >= 0) {
+      tokens.append(PrefixIndex::fold(text.mid(start, i - start)));
+      start = -1;
+    }
+  }
+
+  return tokens;
+}
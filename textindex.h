@@ -0,0 +1,65 @@
+#ifndef TEXTINDEX_H
+#define TEXTINDEX_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <atomic>
+#include <functional>
+
+#include "flatimage.h"
+
+typedef struct {
+  quint32 poolOffset;
+  quint32 length;
+  quint32 firstPosting;
+  quint32 postingCount;
+} TextToken;
+
+// Inverted index over the plain text of the entries of a dictionary.
+//
+// Entries are numbered by their position in the text flow. Like WordStore,
+// everything lives in one FlatImage that can be used from a memory mapped
+// file, the number of entries being a section without elements:
+//
+//   TextToken[tokens] | quint32[postings] | QChar[pool]
+//
+// Tokens are folded words (see PrefixIndex::fold()) in binary order, each
+// pointing to its sorted run of entry ids.
+//
+// Queries are whitespace separated terms which must all match, "quoted
+// phrases" which must appear verbatim, -excluded terms or phrases, and OR
+// between alternatives. Phrases are verified against the entry text.
+class TextIndex {
+ public:
+  typedef std::function<QString(int)> TextFunction;
+
+  TextIndex();
+
+  bool build(int entryCount, const TextFunction& text,
+             const std::atomic<bool>* cancel = nullptr);
+  bool attach(const uchar* data, qint64 size);
+  void clear();
+
+  int entryCount() const;
+  QVector<quint32> postings(const QString& token) const;
+  QVector<quint32> search(const QString& query, const TextFunction& text) const;
+
+  const QByteArray& data() const;
+
+  static QStringList tokenize(const QString& text);
+
+ private:
+  FlatImage m_image;
+
+  const TextToken* m_tokens;
+  const quint32* m_postings;
+  const QChar* m_pool;
+
+  quint32 m_entryCount;
+  quint32 m_tokenCount;
+};
+
+#endif
@@ -0,0 +1,379 @@
+#include <QtConcurrent/qtconcurrentmap.h>
+#include <QDebug>
+#include <QMutexLocker>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+
+#include "textrecordreader.h"
+
+// Internal libmobi record helpers
+extern "C" {
+#include "read.h"
+#include "util.h"
+}
+
+namespace {
+
+const quint16 kNoCompression       = 1;
+const quint16 kPalmDocCompression  = 2;
+const quint16 kHuffCdicCompression = 17480;
+
+}  // namespace
+
+TextRecordReader::TextRecordReader(const MOBIData* m, int cacheRecords)
+{
+  m_mobiData     = m;
+  m_huffcdic     = nullptr;
+  m_recordSize   = 0;
+  m_textLength   = 0;
+  m_compression  = 0;
+  m_extraFlags   = 0;
+  m_randomAccess = false;
+
+  m_cache.setMaxCost(cacheRecords);
+}
+
+TextRecordReader::~TextRecordReader()
+{
+  if (m_huffcdic != nullptr)
+    mobi_free_huffcdic(m_huffcdic);
+}
+
+MOBI_RET TextRecordReader::open(Layout known)
+{
+  const MOBIRecord0Header* rh = m_mobiData->rh;
+  if (rh == nullptr)
+    return MOBI_INIT_FAILED;
+
+  // Decryption is left to the full reconstruction
+  if (mobi_is_encrypted(m_mobiData) || mobi_is_hybrid(m_mobiData))
+    return MOBI_FILE_UNSUPPORTED;
+
+  m_compression = rh->compression_type;
+  m_recordSize  = rh->text_record_size;
+  m_textLength  = rh->text_length;
+
+  if (m_compression != kNoCompression &&
+      m_compression != kPalmDocCompression &&
+      m_compression != kHuffCdicCompression)
+    return MOBI_FILE_UNSUPPORTED;
+
+  if (m_recordSize == 0 || rh->text_record_count == 0)
+    return MOBI_DATA_CORRUPT;
+
+  if (m_mobiData->mh != nullptr && m_mobiData->mh->extra_flags != nullptr)
+    m_extraFlags = *m_mobiData->mh->extra_flags;
+
+  m_records.reserve(rh->text_record_count);
+  for (size_t i = 1; i <= rh->text_record_count; ++i) {
+    const MOBIPdbRecord* r = mobi_get_record_by_seqnumber(m_mobiData, i);
+    if (r == nullptr)
+      return MOBI_DATA_CORRUPT;
+
+    m_records.append(r);
+  }
+
+  if (m_compression == kHuffCdicCompression) {
+    m_huffcdic = mobi_init_huffcdic();
+    if (m_huffcdic == nullptr)
+      return MOBI_MALLOC_FAILED;
+
+    const MOBI_RET ret = mobi_parse_huffdic(m_mobiData, m_huffcdic);
+    if (ret != MOBI_SUCCESS)
+      return ret;
+  }
+
+  if (known != Unchecked) {
+    m_randomAccess = known == RandomAccess;
+    return MOBI_SUCCESS;
+  }
+
+  // Every record but the last one must hold exactly the nominal size and the
+  // last one must end where the text does. Huffman coded records only tell
+  // once decoded, which is done in parallel.
+  const int count = m_records.size();
+  QVector<size_t> sizes(count);
+  std::atomic<bool> failed(false);
+
+  if (m_compression == kHuffCdicCompression) {
+    QVector<int> indexes(count);
+    std::iota(indexes.begin(), indexes.end(), 0);
+
+    QtConcurrent::blockingMap(indexes, [&](const int& index) {
+      QByteArray data;
+      if (failed || !decompress(index, &data))
+        failed = true;
+      else
+        sizes[index] = data.size();
+    });
+  }
+  else {
+    for (int i = 0; i < count && !failed; ++i)
+      failed = !decompressedSize(i, &sizes[i]);
+  }
+
+  quint64 end       = 0;
+  bool nominalSizes = !failed;
+
+  for (int i = 0; i < count && nominalSizes; ++i) {
+    nominalSizes = i + 1 == count || sizes[i] == m_recordSize;
+    end += sizes[i];
+  }
+
+  m_randomAccess = nominalSizes && end == m_textLength;
+  if (!m_randomAccess)
+    qWarning() << "Text records do not match the text length, expected"
+               << m_textLength << "got" << end;
+
+  return MOBI_SUCCESS;
+}
+
+TextRecordReader::Layout TextRecordReader::layout() const
+{
+  return m_randomAccess ? RandomAccess : Sequential;
+}
+
+bool TextRecordReader::isRandomAccess() const
+{
+  return m_randomAccess;
+}
+
+bool TextRecordReader::read(quint32 offset, quint32 length,
+                            QByteArray* out) const
+{
+  if (!m_randomAccess || quint64(offset) + length > m_textLength)
+    return false;
+
+  out->reserve(out->size() + length);
+
+  while (length > 0) {
+    const int index    = offset / m_recordSize;
+    const quint32 skip = offset % m_recordSize;
+    const QByteArray r = record(index);
+
+    // A short record would shift every following offset
+    if (r.isNull() ||
+        (index + 1 < m_records.size() && quint32(r.size()) != m_recordSize) ||
+        skip >= quint32(r.size()))
+      return false;
+
+    const quint32 count = qMin(length, quint32(r.size()) - skip);
+    out->append(r.constData() + skip, count);
+
+    offset += count;
+    length -= count;
+  }
+
+  return true;
+}
+
+MOBIPart* TextRecordReader::readAll() const
+{
+  const int count = m_records.size();
+
+  QVector<int> indexes(count);
+  std::iota(indexes.begin(), indexes.end(), 0);
+  std::atomic<bool> failed(false);
+
+  // Sizes are known up front unless records are Huffman coded, those are
+  // decoded first to find out. Records are independent, HUFF/CDIC ones only
+  // share the read-only tables.
+  QVector<size_t> sizes(count);
+  QVector<QByteArray> records;
+
+  bool sized = true;
+  for (int i = 0; i < count && sized; ++i)
+    sized = decompressedSize(i, &sizes[i]);
+
+  if (!sized) {
+    records.resize(count);
+
+    QtConcurrent::blockingMap(indexes, [&](const int& index) {
+      if (!failed && !decompress(index, &records[index]))
+        failed = true;
+    });
+
+    if (failed)
+      return nullptr;
+
+    for (int i = 0; i < count; ++i)
+      sizes[i] = records[i].size();
+  }
+
+  QVector<size_t> offsets(count);
+  size_t size = 0;
+  for (int i = 0; i < count; ++i) {
+    offsets[i] = size;
+    size += sizes[i];
+  }
+
+  // Allocated the way libmobi does, mobi_free_rawml() releases it
+  MOBIPart* flow = static_cast<MOBIPart*>(calloc(1, sizeof(MOBIPart)));
+  if (flow == nullptr)
+    return nullptr;
+
+  flow->data = static_cast<unsigned char*>(malloc(size + 1));
+  if (flow->data == nullptr) {
+    free(flow);
+    return nullptr;
+  }
+
+  flow->type = T_HTML;
+  flow->size = size;
+
+  // Each record straight into its slot
+  QtConcurrent::blockingMap(indexes, [&](const int& index) {
+    unsigned char* out = flow->data + offsets[index];
+
+    if (!records.isEmpty()) {
+      memcpy(out, records[index].constData(), sizes[index]);
+      return;
+    }
+
+    size_t outSize = sizes[index];
+    if (!failed &&
+        (!decompress(index, out, &outSize) || outSize != sizes[index]))
+      failed = true;
+  });
+
+  if (failed) {
+    free(flow->data);
+    free(flow);
+    return nullptr;
+  }
+
+  flow->data[size] = '\0';
+  return flow;
+}
+
+qint64 TextRecordReader::memoryUsage() const
+{
+  QMutexLocker locker(&m_mutex);
+  return qint64(m_cache.totalCost()) * m_recordSize;
+}
+
+QByteArray TextRecordReader::record(int index) const
+{
+  if (index < 0 || index >= m_records.size())
+    return QByteArray();
+
+  {
+    QMutexLocker locker(&m_mutex);
+    const QByteArray* cached = m_cache.object(index);
+    if (cached != nullptr)
+      return *cached;
+  }
+
+  // Decompress unlocked, racing readers at worst do the same work twice
+  QByteArray data;
+  if (!decompress(index, &data))
+    return QByteArray();
+
+  QMutexLocker locker(&m_mutex);
+  m_cache.insert(index, new QByteArray(data), 1);
+
+  return data;
+}
+
+bool TextRecordReader::textSize(int index, size_t* size) const
+{
+  const MOBIPdbRecord* r = m_records[index];
+
+  size_t extraSize = 0;
+  if (m_extraFlags != 0) {
+    extraSize = mobi_get_record_extrasize(r, m_extraFlags);
+    if (extraSize == MOBI_NOTSET || extraSize >= r->size)
+      return false;
+  }
+
+  *size = r->size - extraSize;
+  return true;
+}
+
+bool TextRecordReader::decompressedSize(int index, size_t* size) const
+{
+  size_t inSize;
+  if (m_compression == kHuffCdicCompression || !textSize(index, &inSize))
+    return false;
+
+  if (m_compression == kNoCompression) {
+    *size = inSize;
+    return true;
+  }
+
+  // Adds up the PalmDOC commands without carrying them out
+  const unsigned char* data = m_records[index]->data;
+  size_t total              = 0;
+
+  for (size_t i = 0; i < inSize;) {
+    const unsigned char c = data[i++];
+
+    if (c >= 0x01 && c <= 0x08) {
+      if (inSize - i < c)
+        return false;
+
+      total += c;
+      i += c;
+    }
+    else if (c < 0x80)
+      total += 1;
+    else if (c >= 0xc0)
+      total += 2;
+    else {
+      if (i == inSize)
+        return false;
+
+      total += (data[i++] & 0x07) + 3;
+    }
+  }
+
+  *size = total;
+  return true;
+}
+
+bool TextRecordReader::decompress(int index, QByteArray* out) const
+{
+  // Records decompress to the nominal size, leave room for corrupt ones to
+  // be detected instead of overflowing
+  size_t outSize = 2 * m_recordSize;
+  if (m_compression == kNoCompression && !textSize(index, &outSize))
+    return false;
+
+  out->resize(outSize);
+  if (!decompress(index, reinterpret_cast<unsigned char*>(out->data()),
+                  &outSize))
+    return false;
+
+  out->resize(outSize);
+  return true;
+}
+
+bool TextRecordReader::decompress(int index, unsigned char* out,
+                                  size_t* outSize) const
+{
+  const MOBIPdbRecord* r = m_records[index];
+
+  size_t inSize;
+  if (!textSize(index, &inSize))
+    return false;
+
+  if (m_compression == kNoCompression) {
+    if (inSize > *outSize)
+      return false;
+
+    memcpy(out, r->data, inSize);
+    *outSize = inSize;
+    return true;
+  }
+
+  MOBI_RET ret;
+  if (m_compression == kPalmDocCompression)
+    ret = mobi_decompress_lz77(out, r->data, outSize, inSize);
+  else
+    ret = mobi_decompress_huffman(out, r->data, outSize, inSize, m_huffcdic);
+
+  return ret == MOBI_SUCCESS;
+}
@@ -0,0 +1,62 @@
+#ifndef TEXTRECORDREADER_H
+#define TEXTRECORDREADER_H
+
+#include <QByteArray>
+#include <QCache>
+#include <QMutex>
+#include <QVector>
+
+#include <mobi.h>
+
+extern "C" {
+#include "compression.h"
+}
+
+// Reads slices of the text flow of a dictionary, decompressing only the text
+// records covering them instead of reconstructing the whole flow.
+//
+// Offsets are mapped to records by the nominal text record size, which only
+// works if every record but the last one holds exactly that much text. Finding
+// out means decompressing or decoding every record, the resulting layout is
+// meant to be kept by the caller and handed back to later opens.
+// Decompressed records are kept in a small LRU cache shared by all readers, so
+// reading is thread-safe. Otherwise the flow can still be decompressed as a
+// whole, record by record in parallel.
+class TextRecordReader {
+ public:
+  enum Layout { Unchecked, RandomAccess, Sequential };
+
+  TextRecordReader(const MOBIData*, int cacheRecords);
+  ~TextRecordReader();
+
+  // Record sizes are only checked when the layout is not known yet
+  MOBI_RET open(Layout known = Unchecked);
+  Layout layout() const;
+  bool isRandomAccess() const;
+  bool read(quint32 offset, quint32 length, QByteArray* out) const;
+  MOBIPart* readAll() const;
+
+  qint64 memoryUsage() const;
+
+ private:
+  QByteArray record(int index) const;
+  bool textSize(int index, size_t* size) const;
+  bool decompressedSize(int index, size_t* size) const;
+  bool decompress(int index, QByteArray* out) const;
+  bool decompress(int index, unsigned char* out, size_t* outSize) const;
+
+  const MOBIData* m_mobiData;
+  MOBIHuffCdic* m_huffcdic;
+  QVector<const MOBIPdbRecord*> m_records;
+
+  quint32 m_recordSize;
+  quint32 m_textLength;
+  quint16 m_compression;
+  quint16 m_extraFlags;
+  bool m_randomAccess;
+
+  mutable QMutex m_mutex;
+  mutable QCache<int, QByteArray> m_cache;
+};
+
+#endif
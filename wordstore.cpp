@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+#include "wordstore.h"
+
+namespace {
+
+enum { Words, Entries, Table, Pool };
+
+}  // namespace
+
+WordStore::WordStore()
+    : m_image({sizeof(StoreWord), sizeof(MobiEntry), sizeof(qint32),
+               sizeof(QChar)})
+{
+  clear();
+}
+
+void WordStore::build(const QStringList &labels,
+                      const QVector<MobiEntry> &entries,
+                      const QCollator &collator)
+{
+  clear();
+
+  const int count = labels.size();
+
+  // Group entries by label, keeping their ORTH order within a group
+  QVector<int> order(count);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return labels[a].compare(labels[b]) < 0;
+  });
+
+  QVector<int> groups;
+  for (int i = 0; i < count; ++i) {
+    if (i == 0 || labels[order[i]] != labels[order[i - 1]])
+      groups.append(i);
+  }
+
+  const int wordCount = groups.size();
+  groups.append(count);
+
+  // Compute the collation keys once instead of collating on each comparison
+  std::vector<QCollatorSortKey> sortKeys;
+  sortKeys.reserve(wordCount);
+  for (int g = 0; g < wordCount; ++g)
+    sortKeys.push_back(collator.sortKey(labels[order[groups[g]]]));
+
+  QVector<int> ranks(wordCount);
+  std::iota(ranks.begin(), ranks.end(), 0);
+  std::stable_sort(ranks.begin(), ranks.end(), [&](int a, int b) {
+    return sortKeys[a].compare(sortKeys[b]) < 0;
+  });
+
+  quint32 poolSize = 0;
+  for (int g = 0; g < wordCount; ++g)
+    poolSize += labels[order[groups[g]]].size();
+
+  m_image.build({quint32(wordCount), quint32(count),
+                 FlatImage::tableSize(wordCount), poolSize});
+
+  StoreWord *words      = m_image.data<StoreWord>(Words);
+  MobiEntry *outEntries = m_image.data<MobiEntry>(Entries);
+  QChar *pool           = m_image.data<QChar>(Pool);
+
+  quint32 poolOffset  = 0;
+  quint32 entryOffset = 0;
+
+  for (int rank = 0; rank < wordCount; ++rank) {
+    const int g          = ranks[rank];
+    const QString &label = labels[order[groups[g]]];
+
+    StoreWord &w = words[rank];
+    w.poolOffset = poolOffset;
+    w.length     = label.size();
+    w.firstEntry = entryOffset;
+    w.entryCount = groups[g + 1] - groups[g];
+
+    memcpy(pool + poolOffset, label.constData(), label.size() * sizeof(QChar));
+    poolOffset += label.size();
+
+    for (int i = groups[g]; i < groups[g + 1]; ++i)
+      outEntries[entryOffset++] = entries[order[i]];
+  }
+
+  FlatImage::buildTable(m_image.data<qint32>(Table), m_image.count(Table),
+                        words, wordCount, pool);
+
+  const QByteArray &data = m_image.data();
+  attach(reinterpret_cast<const uchar *>(data.constData()), data.size());
+}
+
+bool WordStore::attach(const uchar *data, qint64 size)
+{
+  if (!m_image.attach(data, size))
+    return false;
+
+  const quint32 wordCount  = m_image.count(Words);
+  const quint32 entryCount = m_image.count(Entries);
+  const quint32 tableSize  = m_image.count(Table);
+
+  const StoreWord *words = m_image.section<StoreWord>(Words);
+  const qint32 *table    = m_image.section<qint32>(Table);
+
+  if (!FlatImage::isValid(words, wordCount, &StoreWord::poolOffset,
+                          &StoreWord::length, m_image.count(Pool)) ||
+      !FlatImage::isValid(words, wordCount, &StoreWord::firstEntry,
+                          &StoreWord::entryCount, entryCount) ||
+      !FlatImage::isValidTable(table, tableSize, wordCount)) {
+    clear();
+    return false;
+  }
+
+  m_words      = words;
+  m_entries    = m_image.section<MobiEntry>(Entries);
+  m_table      = table;
+  m_pool       = m_image.section<QChar>(Pool);
+  m_wordCount  = wordCount;
+  m_entryCount = entryCount;
+  m_tableSize  = tableSize;
+
+  return true;
+}
+
+void WordStore::clear()
+{
+  m_image.clear();
+
+  m_words      = nullptr;
+  m_entries    = nullptr;
+  m_table      = nullptr;
+  m_pool       = nullptr;
+  m_wordCount  = 0;
+  m_entryCount = 0;
+  m_tableSize  = 0;
+}
+
+int WordStore::count() const
+{
+  return m_wordCount;
+}
+
+int WordStore::entryCount() const
+{
+  return m_entryCount;
+}
+
+int WordStore::find(const QString &word) const
+{
+  return FlatImage::find(m_table, m_tableSize, m_words, m_pool, word);
+}
+
+QString WordStore::word(int rank) const
+{
+  const StoreWord &w = m_words[rank];
+  return QString(m_pool + w.poolOffset, w.length);
+}
+
+const MobiEntry *WordStore::entries(int rank, int *count) const
+{
+  const StoreWord &w = m_words[rank];
+  *count             = w.entryCount;
+  return m_entries + w.firstEntry;
+}
+
+const QByteArray &WordStore::data() const
+{
+  return m_image.data();
+}
@@ -0,0 +1,64 @@
+#ifndef WORDSTORE_H
+#define WORDSTORE_H
+
+#include <QByteArray>
+#include <QCollator>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "flatimage.h"
+
+typedef struct {
+  uint32_t startPos;
+  uint32_t textLength;
+} MobiEntry;
+
+typedef struct {
+  quint32 poolOffset;
+  quint32 length;
+  quint32 firstEntry;
+  quint32 entryCount;
+} StoreWord;
+
+// Compact storage for the headwords of a dictionary.
+//
+// Everything lives in one FlatImage so that it can be built in memory or
+// used straight from a memory mapped index file:
+//
+//   StoreWord[words] | MobiEntry[entries] | qint32[table] | QChar[pool]
+//
+// Words are kept in collation order and addressed by their rank. Each word
+// points to its label in the string pool and to a contiguous run of entries.
+// The table is an open-addressing hash from label to rank.
+class WordStore {
+ public:
+  WordStore();
+
+  void build(const QStringList& labels, const QVector<MobiEntry>& entries,
+             const QCollator& collator);
+  bool attach(const uchar* data, qint64 size);
+  void clear();
+
+  int count() const;
+  int entryCount() const;
+  int find(const QString&) const;
+  QString word(int rank) const;
+  const MobiEntry* entries(int rank, int* count) const;
+
+  const QByteArray& data() const;
+
+ private:
+  FlatImage m_image;
+
+  const StoreWord* m_words;
+  const MobiEntry* m_entries;
+  const qint32* m_table;
+  const QChar* m_pool;
+
+  quint32 m_wordCount;
+  quint32 m_entryCount;
+  quint32 m_tableSize;
+};
+
+#endif